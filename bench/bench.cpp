@@ -0,0 +1,232 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "patch_wrapper.hpp"
+#include "engine.hpp"
+#include "poly_instrument.hpp"
+#include "offline_renderer.hpp"
+#include "patch_program.hpp"
+#include "worker_pool.hpp"
+#include "patches.hpp"
+
+using namespace lyrid;
+
+namespace
+{
+
+struct bench_config
+{
+    double seconds_{2.0};
+    size_t voices_{16};
+};
+
+render_stats run(patch p, render_mode mode, worker_pool* pool, size_t voices, double seconds)
+{
+    poly_instrument instrument(voices, p, mode);
+    instrument.set_worker_pool(pool);
+    for (size_t v = 0; v < voices; ++v)
+        instrument.on(v + 1, 110.0f * (1.0f + v * 0.0625f));
+    
+    std::vector<float> out(static_cast<size_t>(seconds * sample_rate()));
+    offline_renderer renderer(instrument);
+    return renderer.render(out);
+}
+
+// Per-voice state: bytes the voice type occupies, the cache aligned slot
+// it is given, and its share of a lane group at the native width.
+template<typename Patch>
+void report_footprint(const char* name)
+{
+    patch p = wrap<Patch>();
+    
+    std::cout << std::left << std::setw(16) << name
+        << std::right << std::setw(10) << footprint<Patch>::state_bytes
+        << std::setw(10) << p.state_size_
+        << std::setw(8) << p.state_size_ / cache_line_size
+        << std::setw(12) << p.lanes_.state_size_ / p.lanes_.lanes_
+        << "\n";
+}
+
+template<typename Patch>
+void bench_patch(const char* name, const bench_config& cfg, worker_pool& pool)
+{
+    patch p = wrap<Patch>();
+    
+    for (worker_pool* pool_ptr : {static_cast<worker_pool*>(nullptr), &pool})
+    {
+        for (render_mode mode : {render_mode::scalar, render_mode::lanes})
+        {
+            render_stats stats = run(p, mode, pool_ptr, cfg.voices_, cfg.seconds_);
+            double rtf = stats.real_time_factor();
+            size_t threads = pool_ptr != nullptr ? pool_ptr->size() : 1;
+            
+            std::cout << std::left << std::setw(16) << name
+                << std::setw(8) << (mode == render_mode::lanes ? "lanes" : "scalar")
+                << std::right << std::setw(8) << threads
+                << std::fixed << std::setprecision(1)
+                << std::setw(10) << rtf
+                << std::setw(14) << rtf * cfg.voices_ / threads
+                << "\n";
+        }
+    }
+}
+
+// Every patch layered on one engine, one instrument each, spread across
+// the stereo field.
+void bench_engine(const std::vector<patch>& layers, const bench_config& cfg, worker_pool& pool)
+{
+    for (worker_pool* pool_ptr : {static_cast<worker_pool*>(nullptr), &pool})
+    {
+        engine eng(pool_ptr);
+        
+        for (size_t k = 0; k < layers.size(); ++k)
+        {
+            float pan = layers.size() > 1 ? -1.0f + 2.0f * k / (layers.size() - 1) : 0.0f;
+            size_t idx = eng.add_instrument(cfg.voices_, layers[k], engine::master_bus, render_mode::lanes, 1.0f / layers.size(), pan);
+            for (size_t v = 0; v < cfg.voices_; ++v)
+                eng.instrument(idx).on(v + 1, 110.0f * (1.0f + v * 0.0625f));
+        }
+        
+        size_t frames = static_cast<size_t>(cfg.seconds_ * sample_rate());
+        std::vector<float> out(frames * 2);
+        
+        auto start = std::chrono::steady_clock::now();
+        eng.render(out.data(), frames);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        
+        double rtf = cfg.seconds_ / elapsed.count();
+        size_t threads = pool_ptr != nullptr ? pool_ptr->size() : 1;
+        
+        std::cout << std::left << std::setw(16) << ("engine x" + std::to_string(layers.size()))
+            << std::setw(8) << "lanes"
+            << std::right << std::setw(8) << threads
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << rtf
+            << std::setw(14) << rtf * cfg.voices_ * layers.size() / threads
+            << "\n";
+    }
+}
+
+// Text versions of the template patches, for the interpreter.
+template<typename Visit>
+void for_each_program(Visit&& visit)
+{
+    constexpr const char* vibrato = "vibrato = linear(lfo(7), base_freq, 5)\n";
+    
+    visit.template operator()<patches::supersaw>("supersaw", std::string(vibrato) +
+        "volume(mix(saw(detune(vibrato, -8)), saw(detune(vibrato, -5)), saw(detune(vibrato, -2)), saw(vibrato),"
+        " saw(detune(vibrato, 1)), saw(detune(vibrato, 3)), saw(detune(vibrato, 7)), saw(detune(vibrato, 9))),"
+        " envelope_ar(0.5, 5))");
+    visit.template operator()<patches::sine_pad>("sine_pad",
+        "volume(mix(sine(base_freq), sine(detune(base_freq, 1200))), envelope_ar(1, 3))");
+    visit.template operator()<patches::square_lead>("square_lead", std::string(vibrato) +
+        "volume(mix(square(vibrato), triangle(detune(base_freq, -1200))), envelope(0, 0.01, 0, 0.3, 0.6, 0.5))");
+    visit.template operator()<patches::noise_breath>("noise_breath",
+        "volume(mix(pink_noise, saw(base_freq)), envelope_ar(0.2, 1))");
+    visit.template operator()<patches::bl_supersaw>("bl_supersaw", std::string(vibrato) +
+        "volume(mix(bl_saw(detune(vibrato, -8)), bl_saw(detune(vibrato, -5)), bl_saw(detune(vibrato, -2)), bl_saw(vibrato),"
+        " bl_saw(detune(vibrato, 1)), bl_saw(detune(vibrato, 3)), bl_saw(detune(vibrato, 7)), bl_saw(detune(vibrato, 9))),"
+        " envelope_ar(0.5, 5))");
+    visit.template operator()<patches::delayed_pad>("delayed_pad",
+        "volume(mix(sine(base_freq), sine(detune(base_freq, 1200))), envelope(0.5, 1, 0, 0, 1, 3))");
+}
+
+// Interpreted against compiled, one thread, scalar voices; compile is the
+// time to build the program from text.
+template<typename Patch>
+void bench_program(const char* name, const std::string& source, const bench_config& cfg)
+{
+    auto start = std::chrono::steady_clock::now();
+    patch_program program(source);
+    std::chrono::duration<double, std::micro> compile = std::chrono::steady_clock::now() - start;
+    
+    double native = run(wrap<Patch>(), render_mode::scalar, nullptr, cfg.voices_, cfg.seconds_).real_time_factor();
+    double interpreted = run(program.as_patch(), render_mode::scalar, nullptr, cfg.voices_, cfg.seconds_).real_time_factor();
+    
+    std::cout << std::left << std::setw(16) << name
+        << std::right << std::setw(8) << program.instruction_count()
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << compile.count()
+        << std::setw(10) << native
+        << std::setw(10) << interpreted
+        << std::setprecision(2)
+        << std::setw(8) << native / interpreted
+        << "\n";
+}
+
+template<typename Visit>
+void for_each_patch(Visit&& visit)
+{
+    visit.template operator()<patches::supersaw>("supersaw");
+    visit.template operator()<patches::sine_pad>("sine_pad");
+    visit.template operator()<patches::square_lead>("square_lead");
+    visit.template operator()<patches::noise_breath>("noise_breath");
+    visit.template operator()<patches::bl_supersaw>("bl_supersaw");
+    visit.template operator()<patches::fast_sine_pad>("fast_sine_pad");
+    visit.template operator()<patches::bl_square_lead>("bl_square_lead");
+    visit.template operator()<patches::delayed_pad>("delayed_pad");
+    visit.template operator()<patches::unison_supersaw>("unison_supersaw");
+    visit.template operator()<patches::bl_unison_supersaw>("bl_unison_saw");
+    visit.template operator()<patches::filter_pad>("filter_pad");
+    visit.template operator()<patches::filter_bass>("filter_bass");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench_config cfg;
+    if (argc > 1)
+        cfg.seconds_ = std::stod(argv[1]);
+    if (argc > 2)
+        cfg.voices_ = std::stoul(argv[2]);
+    
+    std::cout << std::left << std::setw(16) << "patch"
+        << std::right << std::setw(10) << "state B" << std::setw(10) << "slot B"
+        << std::setw(8) << "lines" << std::setw(12) << "lane B/v" << "\n";
+    
+    for_each_patch(
+        []<typename Patch>(const char* name)
+        {
+            report_footprint<Patch>(name);
+        });
+    
+    std::cout << "\n";
+    
+    std::cout << "lyrid_bench: " << cfg.voices_ << " voices, " << cfg.seconds_ << " s of audio per run, lane width " << native_lanes() << "\n";
+    std::cout << std::left << std::setw(16) << "patch" << std::setw(8) << "mode"
+        << std::right << std::setw(8) << "threads" << std::setw(10) << "rtf" << std::setw(14) << "voices/core" << "\n";
+    
+    worker_pool pool;
+    
+    for_each_patch(
+        [&]<typename Patch>(const char* name)
+        {
+            bench_patch<Patch>(name, cfg, pool);
+        });
+    
+    std::vector<patch> layers;
+    for_each_patch(
+        [&]<typename Patch>(const char*)
+        {
+            layers.push_back(wrap<Patch>());
+        });
+    
+    bench_engine(layers, cfg, pool);
+    
+    std::cout << "\n";
+    std::cout << std::left << std::setw(16) << "program"
+        << std::right << std::setw(8) << "instr" << std::setw(12) << "compile us"
+        << std::setw(10) << "rtf tmpl" << std::setw(10) << "rtf vm" << std::setw(8) << "ratio" << "\n";
+    
+    for_each_program(
+        [&]<typename Patch>(const char* name, const std::string& source)
+        {
+            bench_program<Patch>(name, source, cfg);
+        });
+    
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "patch_wrapper.hpp"
+#include "patch_program.hpp"
+#include "engine.hpp"
+#include "profiler.hpp"
+#include "realtime.hpp"
+#include "rt_check.hpp"
+#include "worker_pool.hpp"
+#include "patches.hpp"
+
+using namespace lyrid;
+
+namespace
+{
+
+constexpr size_t voices = 16;
+
+// Three ids per voice, so stealing runs all the time.
+constexpr uint64_t note_ids = voices * 3;
+
+const char* organ_source =
+    "vibrato = linear(lfo(5.5), base_freq, 2)\n"
+    "volume(mix(sine(vibrato), sine(detune(vibrato, 1200)), triangle(detune(vibrato, 1902))),"
+    " envelope(0, 0.01, 0, 0.1, 0.8, 0.15))";
+
+struct storm_counts
+{
+    size_t events_{0};
+    size_t rejected_{0};
+    size_t publishes_{0};
+};
+
+// Control thread: bursts of note ons, offs and pitch changes on random ids,
+// and now and then a patch swap, until told to stop.
+storm_counts note_storm(engine& eng, const std::vector<patch>& swaps, const std::atomic<bool>& done)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint64_t> pick_id(1, note_ids);
+    std::uniform_int_distribution<int> pick_action(0, 99);
+    std::uniform_real_distribution<float> pick_freq(40.0f, 4000.0f);
+    storm_counts counts;
+
+    while (!done.load(std::memory_order_relaxed))
+    {
+        for (size_t i = 0; i < eng.instrument_count(); ++i)
+        {
+            poly_instrument& instr = eng.instrument(i);
+
+            for (int burst = 0; burst < 32; ++burst)
+            {
+                uint64_t id = pick_id(rng);
+                int action = pick_action(rng);
+                bool posted = action < 50 ? instr.note_on(id, pick_freq(rng))
+                    : action < 85 ? instr.note_off(id)
+                    : instr.set_freq(id, pick_freq(rng));
+
+                counts.events_ += 1;
+                counts.rejected_ += !posted;
+            }
+
+            if (pick_action(rng) < 2)
+            {
+                const patch& p = swaps[counts.publishes_ % swaps.size()];
+                counts.publishes_ += instr.publish(p, pick_action(rng) < 50 ? handoff::crossfade : handoff::finish);
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    return counts;
+}
+
+}
+
+// Renders an engine flat out from a marked real-time thread, in callbacks
+// of varying size, while a control thread storms it with notes and patch
+// swaps. Built with LYRID_RT_CHECK it fails on any allocation, lock or
+// blocking call made while rendering.
+int main(int argc, char** argv)
+{
+    try
+    {
+        double seconds = argc > 1 ? std::stod(argv[1]) : 20.0;
+
+        patch_program organ(organ_source);
+        std::vector<patch> swaps{wrap<patches::unison_supersaw>(), wrap<patches::filter_bass>(), organ.as_patch()};
+
+        worker_pool pool;
+        engine eng(&pool);
+        size_t pads = eng.add_bus(engine::master_bus, 0.8f);
+        eng.add_instrument(voices, wrap<patches::bl_unison_supersaw>(), engine::master_bus, render_mode::scalar, 0.5f, -0.5f);
+        eng.add_instrument(voices, wrap<patches::filter_bass>(), engine::master_bus, render_mode::lanes, 0.5f, 0.5f);
+        eng.add_instrument(voices, wrap<patches::filter_pad>(), pads, render_mode::lanes);
+        eng.add_instrument(voices, organ.as_patch(), pads, render_mode::scalar);
+
+        profiler prof(eng);
+        std::atomic<bool> done{false};
+        storm_counts counts;
+        std::thread control([&]
+        {
+            counts = note_storm(eng, swaps, done);
+        });
+
+        size_t total = static_cast<size_t>(seconds * sample_rate());
+        size_t non_finite = 0;
+
+        std::thread render([&]
+        {
+            prepare_render_thread(0);
+            std::vector<float> out(max_block_size * 4 * 2);
+            std::minstd_rand rng(99);
+
+            for (size_t frames = 0; frames < total;)
+            {
+                size_t n = std::min<size_t>(total - frames, 1 + rng() % (max_block_size * 4));
+
+                {
+                    rt_scope scope;
+                    uint64_t start = prof.begin();
+                    eng.render(out.data(), n);
+                    prof.end(start, n);
+                }
+
+                for (size_t i = 0; i < n * 2; ++i)
+                    non_finite += !std::isfinite(out[i]);
+                frames += n;
+            }
+        });
+
+        render.join();
+        done.store(true, std::memory_order_relaxed);
+        control.join();
+
+        std::cout << "rendered " << seconds << " s, " << counts.events_ << " events (" << counts.rejected_
+            << " rejected), " << counts.publishes_ << " patch swaps\n";
+        std::cout << profiler::to_text(prof.snapshot()) << "\n";
+        std::cout << "non-finite samples " << non_finite << ", real-time violations " << rt_violations() << "\n";
+
+        return non_finite == 0 && rt_violations() == 0 ? 0 : 1;
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
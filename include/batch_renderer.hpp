@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "patch.hpp"
+#include "poly_instrument.hpp"
+
+namespace lyrid
+{
+
+// One score to bounce, and the WAV file to write.
+struct batch_job
+{
+    std::string score_;
+    std::string output_;
+};
+
+struct batch_result
+{
+    size_t frames_{0};
+    double render_seconds_{0.0};
+    std::string error_;
+};
+
+struct batch_stats
+{
+    size_t jobs_{0};
+    size_t failed_{0};
+    double audio_seconds_{0.0};
+    double wall_seconds_{0.0};
+
+    // Hours of audio rendered per minute of wall clock time.
+    double hours_per_minute() const;
+};
+
+// Offline bounce of many scores through one patch. A fixed set of threads,
+// at most one per core, take jobs in order until none are left; each job
+// gets its own instrument and renders single threaded, so throughput
+// scales with the number of jobs in flight rather than voices.
+class batch_renderer
+{
+public:
+    batch_renderer(patch p, size_t voices, render_mode mode = render_mode::lanes,
+        size_t threads = std::max(std::thread::hardware_concurrency(), 1u));
+
+    // results receives one entry per job, in job order. Jobs that fail are
+    // reported there and do not stop the others.
+    batch_stats run(const std::vector<batch_job>& jobs, std::vector<batch_result>& results);
+
+private:
+    batch_result render_job(const batch_job& job);
+
+    patch patch_;
+    size_t voices_;
+    render_mode mode_;
+    size_t threads_;
+};
+
+}
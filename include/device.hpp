@@ -2,24 +2,60 @@
 
 #include <miniaudio.h>
 
+#include <cstdint>
+
 namespace lyrid
 {
     
-class poly_instrument;
+class engine;
+class profiler;
+
+// How the output device is opened. The defaults leave buffering and
+// scheduling to miniaudio and the backend.
+struct device_config
+{
+    // Frames per callback and number of periods; zero leaves them to the backend.
+    uint32_t period_frames_{0};
+    uint32_t periods_{0};
+    bool low_latency_{false};
+    
+    // SCHED_FIFO priority of the callback thread, 0 leaves it as created.
+    int rt_priority_{0};
+    
+    // Locks the process in memory once the device is open.
+    bool lock_memory_{false};
+    
+    // Periods of 128 frames, under 3 ms at 48 kHz, two in flight.
+    static device_config low_latency()
+    {
+        return device_config{128, 2, true, 80, true};
+    }
+};
 
+// Playback through the default output, at its native rate: opening it sets
+// the engine's sample rate, so it has to happen before notes are played.
 class device
 {
 public:
-    device(poly_instrument& instr);
+    device(engine& eng, const device_config& config = {});
     ~device();
     
     void start();
     
+    // Brackets every callback; set before start().
+    void set_profiler(profiler* p)
+    {
+        profiler_ = p;
+    }
+    
 private:
     static void data_callback(ma_device* device_ptr, void* output_ptr, const void* input_ptr, ma_uint32 frame_count);
     
+    ma_context context_;
     ma_device dev_;
-    poly_instrument& instr_;
+    engine& engine_;
+    profiler* profiler_{nullptr};
+    int rt_priority_;
     bool initialized_{false};
 };
 
@@ -2,6 +2,11 @@
 
 #include <voice_parameters.hpp>
 
+#include "node.hpp"
+#include "lanes.hpp"
+
+#include <algorithm>
+
 namespace lyrid
 {
  
@@ -10,10 +15,30 @@ namespace dsp
     
 struct base_freq
 {
+    static constexpr rate node_rate = rate::note;
+    
     inline float sample(const voice_parameters& params)
     {
         return params.base_freq_;
     }
+    
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        std::fill_n(out, frames, params.base_freq_);
+    }
+};
+
+template<size_t Lanes>
+struct lane_batch<base_freq, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+                out[i * Lanes + l] = params.base_freq_[l];
+        }
+    }
 };
 
 }
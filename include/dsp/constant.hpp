@@ -2,6 +2,11 @@
 
 #include <voice_parameters.hpp>
 
+#include "node.hpp"
+#include "lanes.hpp"
+
+#include <algorithm>
+
 namespace lyrid
 {
  
@@ -11,10 +16,26 @@ namespace dsp
 template<float Cnst>
 struct constant
 {
+    static constexpr rate node_rate = rate::constant;
+    
     inline float sample(const voice_parameters&)
     {
         return Cnst;
     }
+    
+    inline void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        std::fill_n(out, frames, Cnst);
+    }
+};
+
+template<float Cnst, size_t Lanes>
+struct lane_batch<constant<Cnst>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>&, float* out, size_t frames)
+    {
+        std::fill_n(out, frames * Lanes, Cnst);
+    }
 };
 
 }
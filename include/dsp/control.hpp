@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cmath>
+
+#include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+#include "phase.hpp"
+#include "envelope.hpp"
+#include <voice_parameters.hpp>
+
+namespace lyrid
+{
+
+namespace dsp
+{
+
+// Samples between two updates of a control rate source.
+constexpr size_t control_interval = 32;
+
+// Per sample recurrence towards each new control value, landing within 1%
+// of it by the next update. Rounds the corners a linear_ramp leaves.
+struct one_pole_glide
+{
+    void start(float, float to, uint32_t samples)
+    {
+        if (samples != samples_)
+        {
+            coeff_ = 1.0f - std::pow(0.01f, 1.0f / samples);
+            samples_ = samples;
+        }
+        target_ = to;
+    }
+
+    void hold(float value)
+    {
+        value_ = value;
+        target_ = value;
+    }
+
+    float value() const
+    {
+        return value_;
+    }
+
+    void render(float* out, size_t frames)
+    {
+        for (size_t i = 0; i < frames; ++i)
+        {
+            value_ += coeff_ * (target_ - value_);
+            out[i] = value_;
+        }
+    }
+
+    float value_{0.0f};
+    float target_{0.0f};
+    float coeff_{1.0f};
+    uint32_t samples_{0};
+};
+
+enum class lfo_shape : uint8_t
+{
+    sine,
+    triangle,
+    saw,
+    square
+};
+
+// Control source: tick() advances by a number of samples and returns the
+// value there. The rate is read once per tick, so it has to be invariant.
+template<typename Freq, lfo_shape Shape = lfo_shape::sine>
+struct lfo
+{
+    static_assert(is_invariant<Freq>, "lfo rates are per note");
+
+    float tick(const voice_parameters& params, size_t samples)
+    {
+        phase_ += phase_increment(freq_.sample(params), phase_scale()) * static_cast<uint32_t>(samples);
+
+        if constexpr (Shape == lfo_shape::sine)
+            return fast_sine_wave::at(phase_);
+        else if constexpr (Shape == lfo_shape::triangle)
+            return triangle_wave::at(phase_);
+        else if constexpr (Shape == lfo_shape::saw)
+            return saw_wave::at(phase_);
+        else
+            return square_wave::at(phase_);
+    }
+
+    auto children()
+    {
+        return std::tie(freq_);
+    }
+
+    [[no_unique_address]] hoisted_t<Freq> freq_;
+    uint32_t phase_{0};
+};
+
+// Audio rate view of a control source: Src ticks once every Interval
+// samples and Interp fills in between, ramping to where Src will be at
+// the end of each interval.
+template<typename Src, typename Interp = linear_ramp, size_t Interval = control_interval>
+struct control
+{
+    static constexpr rate node_rate = rate::control;
+
+    float sample(const voice_parameters& params)
+    {
+        float out;
+        process_block(params, &out, 1);
+        return out;
+    }
+
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        if (!started_)
+        {
+            interp_.hold(src_.tick(params, 0));
+            started_ = true;
+        }
+
+        while (frames > 0)
+        {
+            if (remaining_ == 0)
+            {
+                interp_.start(interp_.value(), src_.tick(params, Interval), Interval);
+                remaining_ = Interval;
+            }
+
+            size_t n = std::min<size_t>(frames, remaining_);
+            interp_.render(out, n);
+            out += n;
+            frames -= n;
+            remaining_ -= n;
+        }
+    }
+
+    auto children()
+    {
+        return std::tie(src_);
+    }
+
+    [[no_unique_address]] Src src_;
+    Interp interp_;
+    uint32_t remaining_{0};
+    bool started_{false};
+};
+
+// Src scaled by Depth: one entry of a modulation matrix.
+template<typename Src, typename Depth>
+struct route
+{
+    static constexpr rate node_rate = max_rate<Src, Depth>;
+
+    inline float sample(const voice_parameters& params)
+    {
+        return src_.sample(params) * depth_.sample(params);
+    }
+
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        src_.process_block(params, out, frames);
+
+        if constexpr (is_invariant<Depth>)
+            scale_block(out, depth_.sample(params), frames);
+        else
+        {
+            float depth[max_block_size];
+            depth_.process_block(params, depth, frames);
+            multiply_block(out, depth, frames);
+        }
+    }
+
+    auto children()
+    {
+        return std::tie(src_, depth_);
+    }
+
+    [[no_unique_address]] hoisted_t<Src> src_;
+    [[no_unique_address]] hoisted_t<Depth> depth_;
+};
+
+// Parameter Base plus the sum of its routes. A voice's modulated<>
+// parameters together make up its modulation matrix; a source routed to
+// several of them is rendered once, through dedup_t.
+template<typename Base, typename... Routes>
+struct modulated
+{
+    static constexpr rate node_rate = max_rate<Base, Routes...>;
+
+    inline float sample(const voice_parameters& params)
+    {
+        return routes_.apply(
+            [&](auto&... r)
+            {
+                return (base_.sample(params) + ... + r.sample(params));
+            }
+        );
+    }
+
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float val[max_block_size];
+        base_.process_block(params, out, frames);
+
+        routes_.apply(
+            [&](auto&... r)
+            {
+                ((r.process_block(params, val, frames), add_block(out, val, frames)), ...);
+            }
+        );
+    }
+
+    auto children()
+    {
+        return std::tuple_cat(std::tie(base_), tie_all(routes_));
+    }
+
+    [[no_unique_address]] hoisted_t<Base> base_;
+    [[no_unique_address]] node_tuple<hoisted_t<Routes>...> routes_;
+};
+
+template<typename Base, typename... Routes, size_t Lanes>
+struct lane_batch<modulated<Base, Routes...>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float val[lane_buffer_size];
+        base_.process_block(params, out, frames);
+
+        routes_.apply(
+            [&](auto&... r)
+            {
+                ((r.process_block(params, val, frames), add_block(out, val, frames * Lanes)), ...);
+            }
+        );
+    }
+
+    auto children()
+    {
+        return std::tuple_cat(std::tie(base_), tie_all(routes_));
+    }
+
+    [[no_unique_address]] lane_batch<hoisted_t<Base>, Lanes> base_;
+    [[no_unique_address]] node_tuple<lane_batch<hoisted_t<Routes>, Lanes>...> routes_;
+};
+
+template<typename Src, typename Depth, size_t Lanes>
+struct lane_batch<route<Src, Depth>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float depth[lane_buffer_size];
+        src_.process_block(params, out, frames);
+        depth_.process_block(params, depth, frames);
+        multiply_block(out, depth, frames * Lanes);
+    }
+
+    auto children()
+    {
+        return std::tie(src_, depth_);
+    }
+
+    [[no_unique_address]] lane_batch<hoisted_t<Src>, Lanes> src_;
+    [[no_unique_address]] lane_batch<hoisted_t<Depth>, Lanes> depth_;
+};
+
+}
+
+}
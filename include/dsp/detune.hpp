@@ -3,6 +3,8 @@
 #include <voice_parameters.hpp>
 
 #include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
 
 namespace lyrid
 {
@@ -13,15 +15,87 @@ namespace dsp
 template<typename Val, typename Cents>
 struct detune
 {
+    static constexpr rate node_rate = max_rate<Val, Cents>;
+    
     inline float sample(const voice_parameters& params)
     {
-        float base = val_.sample(params);
-        float dt = base * (std::pow(2.0, cents_.sample(params) / 1200.0f) - 1.0f);
-        return base + dt;
+        if constexpr (is_invariant<Cents>)
+            return val_.sample(params) * ratio_;
+        else
+            return val_.sample(params) * cents_to_ratio(cents_.sample(params));
+    }
+    
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        val_.process_block(params, out, frames);
+        
+        if constexpr (is_invariant<Cents>)
+            scale_block(out, ratio_, frames);
+        else
+        {
+            float cents[max_block_size];
+            cents_.process_block(params, cents, frames);
+            
+            for (size_t i = 0; i < frames; ++i)
+                out[i] *= cents_to_ratio(cents[i]);
+        }
+    }
+    
+    void on_note(const voice_parameters& params)
+    {
+        if constexpr (is_invariant<Cents>)
+            ratio_ = cents_to_ratio(cents_.sample(params));
+    }
+    
+    auto children()
+    {
+        return std::tie(val_, cents_);
+    }
+    
+    [[no_unique_address]] hoisted_t<Val> val_;
+    [[no_unique_address]] hoisted_t<Cents> cents_;
+    float ratio_{1.0f};
+};
+
+template<typename Val, typename Cents, size_t Lanes>
+struct lane_batch<detune<Val, Cents>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        val_.process_block(params, out, frames);
+        
+        if constexpr (is_invariant<Cents>)
+        {
+            for (size_t i = 0; i < frames; ++i)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                    out[i * Lanes + l] *= ratio_[l];
+            }
+        }
+        else
+        {
+            float cents[lane_buffer_size];
+            cents_.process_block(params, cents, frames);
+            
+            for (size_t i = 0; i < frames * Lanes; ++i)
+                out[i] *= cents_to_ratio(cents[i]);
+        }
+    }
+    
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        if constexpr (is_invariant<Cents>)
+            ratio_[lane] = cents_to_ratio(evaluate_invariant<hoisted_t<Cents>>(params));
+    }
+    
+    auto children()
+    {
+        return std::tie(val_, cents_);
     }
     
-    Val val_;
-    Cents cents_;
+    [[no_unique_address]] lane_batch<hoisted_t<Val>, Lanes> val_;
+    [[no_unique_address]] lane_batch<hoisted_t<Cents>, Lanes> cents_;
+    std::array<float, Lanes> ratio_{};
 };
 
 }
@@ -1,14 +1,21 @@
 #pragma once
 
 #include "constant.hpp"
+#include "node.hpp"
 #include <voice_parameters.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
 namespace lyrid
 {
- 
+
 namespace dsp
 {
-    
+
 enum class env_stage : uint8_t
 {
     off,
@@ -20,13 +27,108 @@ enum class env_stage : uint8_t
     release
 };
 
+// Straight segment, out[i] = value + step * i. The index converts as
+// int32_t, which stays in vector registers; frames never exceed a block.
+struct linear_ramp
+{
+    void start(float from, float to, uint32_t samples)
+    {
+        value_ = from;
+        step_ = (to - from) / samples;
+    }
+
+    void hold(float value)
+    {
+        value_ = value;
+        step_ = 0.0f;
+    }
+
+    float value() const
+    {
+        return value_;
+    }
+
+    void render(float* out, size_t frames)
+    {
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = value_ + step_ * static_cast<int32_t>(i);
+        value_ += step_ * frames;
+    }
+
+    float value_{0.0f};
+    float step_{0.0f};
+};
+
+// Analog style curve: exponential approach to a goal overshooting the
+// target by Ratio times the segment height, timed to land on the target.
+// Smaller ratios bend harder. Rendered width samples at a time from
+// precomputed powers, so the inner loop carries no dependency.
+template<float Ratio>
+struct exponential_ramp
+{
+    static constexpr size_t width = 8;
+
+    void start(float from, float to, uint32_t samples)
+    {
+        goal_ = to + (to - from) * Ratio;
+        offset_ = from - goal_;
+
+        float mult = std::pow(Ratio / (1.0 + Ratio), 1.0 / samples);
+        powers_[0] = 1.0f;
+        for (size_t k = 1; k < width; ++k)
+            powers_[k] = powers_[k - 1] * mult;
+        stride_ = powers_[width - 1] * mult;
+    }
+
+    void hold(float value)
+    {
+        goal_ = value;
+        offset_ = 0.0f;
+        powers_.fill(1.0f);
+        stride_ = 1.0f;
+    }
+
+    float value() const
+    {
+        return goal_ + offset_;
+    }
+
+    void render(float* out, size_t frames)
+    {
+        size_t i = 0;
+        for (; i + width <= frames; i += width)
+        {
+            for (size_t k = 0; k < width; ++k)
+                out[i + k] = goal_ + offset_ * powers_[k];
+            offset_ *= stride_;
+        }
+
+        size_t tail = frames - i;
+        if (tail == 0)
+            return;
+        
+        for (size_t k = 0; k < tail; ++k)
+            out[i + k] = goal_ + offset_ * powers_[k];
+        offset_ *= powers_[tail];
+    }
+
+    float goal_{0.0f};
+    float offset_{0.0f};
+    std::array<float, width> powers_{};
+    float stride_{1.0f};
+};
+
+// Stages are timed in whole samples. A block is cut at stage boundaries
+// only, each piece is one ramp from Shape, so nothing is decided per sample.
+// The gate is read once per block, poly_instrument splits blocks at events.
 template<
     typename Del,
     typename Att,
     typename Hld,
     typename Dec,
     typename Sus,
-    typename Rel
+    typename Rel,
+    typename Shape = linear_ramp
 >
 class envelope
 {
@@ -37,161 +139,211 @@ public:
 
     envelope()
     {
-        del_t_ = 0.0f;
-        att_t_ = 0.0f;
-        hld_t_ = 0.0f;
-        dec_t_ = 0.0f;
+        del_n_ = 0;
+        att_n_ = 1;
+        hld_n_ = 0;
+        dec_n_ = 0;
         sus_target_ = 1.0f;
-        rel_t_ = 0.0f;
+        rel_n_ = 1;
         stage_ = env_stage::off;
-        sus_at_rel_ = 0.0f;
-        time_ = 0.0f;
+        remaining_ = forever;
         active_ = false;
     };
-        
+
+    // For inputs that carry their own values, see dsp::variable.
+    envelope(Del del, Att att, Hld hld, Dec dec, Sus sus, Rel rel):
+        envelope()
+    {
+        del_ = del;
+        att_ = att;
+        hld_ = hld;
+        dec_ = dec;
+        sus_ = sus;
+        rel_ = rel;
+    }
+
     float sample(const voice_parameters& params)
+    {
+        float out;
+        process_block(params, &out, 1);
+        return out;
+    }
+
+    void process_block(const voice_parameters& params, float* out, size_t frames)
     {
         bool active = (params.state_ == voice_state::active);
-        if (!active_ && active)
-            capture_parameters(params);
-        active_ = active;
-    
-        float out = 0.0f;
-        
-        switch (stage_)
+        if (active != active_)
+            gate(params, active);
+
+        while (frames > 0)
         {
-            case env_stage::off:
+            size_t n = std::min<size_t>(frames, remaining_);
+            ramp_.render(out, n);
+            out += n;
+            frames -= n;
+
+            if (remaining_ != forever)
             {
-                if (active_)
-                {
-                    stage_ = del_t_ > 0.0f ? env_stage::delay : env_stage::attack;
-                }
-                break;
+                remaining_ -= n;
+                if (remaining_ == 0)
+                    advance();
             }
+        }
+    }
+
+    // Silent while holding zero: before the first note, through a delay,
+    // at a zero sustain and once released.
+    size_t quiet(const voice_parameters& params)
+    {
+        bool active = (params.state_ == voice_state::active);
+        if (active != active_ || ramp_.value() != 0.0f)
+            return 0;
+        
+        if (stage_ != env_stage::off && stage_ != env_stage::delay && stage_ != env_stage::sustain)
+            return 0;
+        
+        return remaining_ == forever ? always_quiet : remaining_;
+    }
+    
+    auto children()
+    {
+        return std::tie(del_, att_, hld_, dec_, sus_, rel_);
+    }
+
+private:
+    static constexpr uint32_t forever = std::numeric_limits<uint32_t>::max();
 
+    static uint32_t to_samples(float sec)
+    {
+        return static_cast<uint32_t>(std::lround(sec * sample_rate()));
+    }
+
+    void gate(const voice_parameters& params, bool active)
+    {
+        active_ = active;
+
+        if (active_)
+        {
+            capture_parameters(params);
+            enter(del_n_ > 0 ? env_stage::delay : env_stage::attack);
+        }
+        else if (stage_ != env_stage::off)
+            enter(env_stage::release);
+    }
+
+    void advance()
+    {
+        switch (stage_)
+        {
             case env_stage::delay:
-            {
-                if (time_ >= del_t_)
-                {
-                    stage_ = env_stage::attack;
-                    time_ -= del_t_;
-                }
+                enter(env_stage::attack);
                 break;
-            }
-
             case env_stage::attack:
-            {
-                out = linear_segment(0.0f, 1.0f, att_t_, hld_t_ > 0.0f ? env_stage::hold : env_stage::decay);
+                enter(hld_n_ > 0 ? env_stage::hold : env_stage::decay);
                 break;
-            }
-
             case env_stage::hold:
-            {
-                out = 1.0f;
-                if (time_ >= hld_t_)
-                {
-                    stage_ = env_stage::decay;
-                    time_ -= hld_t_;
-                }
+                enter(env_stage::decay);
                 break;
-            }
-
             case env_stage::decay:
-            {
-                out = linear_segment(1.0f, sus_target_, dec_t_, env_stage::sustain);
+                enter(env_stage::sustain);
                 break;
-            }
+            case env_stage::release:
+                enter(env_stage::off);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Ramps start from the current level, so retriggers and early releases
+    // continue without a step.
+    void enter(env_stage stage)
+    {
+        stage_ = stage;
 
+        switch (stage)
+        {
+            case env_stage::off:
+                steady(0.0f);
+                break;
+            case env_stage::delay:
+                fixed(ramp_.value(), del_n_);
+                break;
+            case env_stage::attack:
+                segment(1.0f, att_n_);
+                break;
+            case env_stage::hold:
+                fixed(1.0f, hld_n_);
+                break;
+            case env_stage::decay:
+                if (dec_n_ == 0)
+                    enter(env_stage::sustain);
+                else
+                    segment(sus_target_, dec_n_);
+                break;
             case env_stage::sustain:
-            {
-                time_ = 0.0f;
-                out = sus_target_;
-
-                if (!active_)
-                {
-                    sus_at_rel_ = out;
-                    stage_ = env_stage::release;
-                }
+                steady(sus_target_);
                 break;
-            }
-
             case env_stage::release:
-            {
-                if (active_)
-                {
-                    stage_ = (del_t_ > 0.0f ? env_stage::delay : env_stage::attack);
-                    break;
-                }
-
-                out = linear_segment(sus_at_rel_, 0.0f, rel_t_, env_stage::off);
+                segment(0.0f, rel_n_);
                 break;
-            }
         }
-
-        time_ += 1.0f / sample_rate;
-        
-        if (out < 0.0)
-            return 0.0f;
-        return out;
     }
-    
-private:
-    float linear_segment(float start, float target, float time_sec, env_stage next_stage)
+
+    void segment(float target, uint32_t samples)
     {
-        if (time_sec <= 0.0f)
-        {
-            stage_ = next_stage;
-            return target;
-        }
+        ramp_.start(ramp_.value(), target, samples);
+        remaining_ = samples;
+    }
 
-        if (time_ >= time_sec)
-        {
-            stage_ = next_stage;
-            time_ -= time_sec;
-            return target;
-        }
+    void fixed(float value, uint32_t samples)
+    {
+        ramp_.hold(value);
+        remaining_ = samples;
+    }
 
-        float p = time_ / time_sec;
-        return start + (target - start) * p;
+    void steady(float value)
+    {
+        ramp_.hold(value);
+        remaining_ = forever;
     }
-    
+
     void capture_parameters(const voice_parameters& params)
     {
-        del_t_ = std::max(0.0f, del_.sample(params));
-        att_t_ = std::max(min_attack_sec, att_.sample(params));
-        hld_t_ = std::max(0.0f, hld_.sample(params));
-        rel_t_ = std::max(min_release_sec, rel_.sample(params));
+        del_n_ = to_samples(std::max(0.0f, del_.sample(params)));
+        att_n_ = to_samples(std::max(min_attack_sec, att_.sample(params)));
+        hld_n_ = to_samples(std::max(0.0f, hld_.sample(params)));
+        rel_n_ = to_samples(std::max(min_release_sec, rel_.sample(params)));
 
         sus_target_ = sus_.sample(params);
 
-        dec_t_ = (sus_target_ != 1.0f)
-            ? std::max(min_decay_sec, dec_.sample(params))
-            : std::max(0.0f, dec_.sample(params));
+        dec_n_ = (sus_target_ != 1.0f)
+            ? to_samples(std::max(min_decay_sec, dec_.sample(params)))
+            : to_samples(std::max(0.0f, dec_.sample(params)));
     }
-    
-    float del_t_{0.0f};
-    float att_t_{0.0f};
-    float hld_t_{0.0f};
-    float dec_t_{0.0f};
-    float sus_target_{1.0f};
-    float rel_t_{0.0f};
-
-    env_stage stage_{env_stage::off};
-    float sus_at_rel_{0.0f};
-    
-    float time_{0.0f};
-    bool active_{false};
-    
-    Del del_;
-    Att att_;
-    Hld hld_;
-    Dec dec_;
-    Sus sus_;
-    Rel rel_;
+
+    uint32_t del_n_;
+    uint32_t att_n_;
+    uint32_t hld_n_;
+    uint32_t dec_n_;
+    float sus_target_;
+    uint32_t rel_n_;
+
+    env_stage stage_;
+    uint32_t remaining_;
+    bool active_;
+    [[no_unique_address]] Shape ramp_;
+
+    [[no_unique_address]] Del del_;
+    [[no_unique_address]] Att att_;
+    [[no_unique_address]] Hld hld_;
+    [[no_unique_address]] Dec dec_;
+    [[no_unique_address]] Sus sus_;
+    [[no_unique_address]] Rel rel_;
 };
 
-template<typename Att, typename Rel>
-using envelope_ar = envelope<constant<0.0f>, Att, constant<0.0f>, constant<0.0f>, constant<1.0f>, Rel>;
+template<typename Att, typename Rel, typename Shape = linear_ramp>
+using envelope_ar = envelope<constant<0.0f>, Att, constant<0.0f>, constant<0.0f>, constant<1.0f>, Rel, Shape>;
 
 }
 
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <voice_parameters.hpp>
+
+#include "node.hpp"
+
+#include <algorithm>
+
+namespace lyrid
+{
+ 
+namespace dsp
+{
+
+// Leaves whose values are written from outside the tree before each block,
+// so nodes can be driven by data rather than by child types.
+
+// Per-note value, such as a coefficient computed at note-on.
+struct variable
+{
+    static constexpr rate node_rate = rate::note;
+    
+    inline float sample(const voice_parameters&)
+    {
+        return value_;
+    }
+    
+    inline void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        std::fill_n(out, frames, value_);
+    }
+    
+    float value_{0.0f};
+};
+
+// Audio rate signal rendered elsewhere. src_ must cover the frames of the
+// next process_block call.
+struct input
+{
+    inline float sample(const voice_parameters&)
+    {
+        return *src_++;
+    }
+    
+    inline void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        std::copy_n(src_, frames, out);
+    }
+    
+    const float* src_{nullptr};
+};
+
+}
+
+}
@@ -0,0 +1,445 @@
+#pragma once
+
+#include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+#include "control.hpp"
+#include <voice_parameters.hpp>
+
+#include <array>
+#include <type_traits>
+
+namespace lyrid
+{
+
+namespace dsp
+{
+
+// Integrator gain of a trapezoidal one-pole at cutoff, tan(pi * cutoff / sample_rate()),
+// with the cutoff kept inside (0, 0.49) of the sample rate.
+inline float prewarp(float cutoff)
+{
+    float ratio = std::clamp(cutoff * rates().sample_period_, 1e-5f, 0.49f);
+    return std::tan(std::numbers::pi_v<float> * ratio);
+}
+
+// The same gain as sin / cos from fast_sin, cheap enough to follow a
+// modulated cutoff.
+inline float fast_prewarp(float cutoff)
+{
+    float phase = std::clamp(cutoff * rates().sample_period_, 1e-5f, 0.49f) * 0.5f;
+    return fast_sin(phase) / fast_sin(0.25f - phase);
+}
+
+// Outputs of the state variable filter.
+struct lowpass
+{};
+
+struct bandpass
+{};
+
+struct highpass
+{};
+
+struct notch
+{};
+
+// Resonance runs from 0 to just below self-oscillation at 1.
+inline void svf_coefficients(float g, float res, float& k, float& a1, float& a2, float& a3)
+{
+    k = 2.0f - 2.0f * std::clamp(res, 0.0f, 0.99f);
+    a1 = 1.0f / (1.0f + g * (g + k));
+    a2 = g * a1;
+    a3 = g * a2;
+}
+
+// Trapezoidal state variable filter step (Zavalishin, Simper).
+template<typename Mode>
+inline float svf_tick(float x, float k, float a1, float a2, float a3, float& ic1, float& ic2)
+{
+    float v3 = x - ic2;
+    float v1 = a1 * ic1 + a2 * v3;
+    float v2 = ic2 + a2 * ic1 + a3 * v3;
+    ic1 = 2.0f * v1 - ic1;
+    ic2 = 2.0f * v2 - ic2;
+
+    if constexpr (std::is_same_v<Mode, lowpass>)
+        return v2;
+    else if constexpr (std::is_same_v<Mode, bandpass>)
+        return v1;
+    else if constexpr (std::is_same_v<Mode, highpass>)
+        return x - k * v1 - v2;
+    else
+        return x - k * v1;
+}
+
+inline void ladder_coefficients(float g, float res, float& gain, float& k, float& norm)
+{
+    gain = g / (1.0f + g);
+    k = 4.0f * std::clamp(res, 0.0f, 0.99f);
+    norm = 1.0f / (1.0f + k * pow4(gain));
+}
+
+// Four trapezoidal one-poles with the feedback solved for the current
+// sample, so resonance stays in tune at high cutoffs. Each stage outputs
+// gain * in + (1 - gain) * state. Expanding the cascade gives every stage
+// output directly from the solved input u, so the per-sample dependency
+// chain runs through one multiply-add per stage rather than four in series.
+inline float ladder_tick(float x, float gain, float k, float norm, float& s0, float& s1, float& s2, float& s3)
+{
+    float g2 = gain * gain;
+    float g3 = g2 * gain;
+    float g4 = g2 * g2;
+
+    float c0 = (1.0f - gain) * s0;
+    float c1 = (1.0f - gain) * s1;
+    float c2 = (1.0f - gain) * s2;
+    float c3 = (1.0f - gain) * s3;
+    float p1 = gain * c0 + c1;
+    float p2 = gain * p1 + c2;
+    float sum = (g3 * c0 + g2 * c1) + (gain * c2 + c3);
+    float u = norm * x - k * norm * sum;
+
+    float y0 = gain * u + c0;
+    float y1 = g2 * u + p1;
+    float y2 = g3 * u + p2;
+    float y3 = g4 * u + sum;
+    s0 = 2.0f * y0 - s0;
+    s1 = 2.0f * y1 - s1;
+    s2 = 2.0f * y2 - s2;
+    s3 = 2.0f * y3 - s3;
+    return y3;
+}
+
+// Filter state shared by the nodes below: coefficients are cached while
+// Cutoff and Res are per-note, and recomputed with fast_prewarp once every
+// control_interval frames while they move.
+template<typename Val, typename Cutoff, typename Res>
+struct filter_inputs
+{
+    static constexpr bool modulated = !is_invariant<Cutoff> || !is_invariant<Res>;
+
+    // Renders the inputs, cutoff and resonance first so out may share
+    // their storage.
+    void render(const voice_parameters& params, float* out, float* cutoff, float* res, size_t frames)
+    {
+        if constexpr (!is_invariant<Cutoff>)
+            cutoff_.process_block(params, cutoff, frames);
+        if constexpr (!is_invariant<Res>)
+            res_.process_block(params, res, frames);
+        val_.process_block(params, out, frames);
+    }
+
+    // Whether per-note inputs differ from the ones the coefficients were
+    // computed for.
+    bool changed(const voice_parameters& params)
+    {
+        float cutoff = cutoff_.sample(params);
+        float res = res_.sample(params);
+        if (cutoff == cutoff_seen_ && res == res_seen_)
+            return false;
+        cutoff_seen_ = cutoff;
+        res_seen_ = res;
+        return true;
+    }
+
+    float cutoff_at(const voice_parameters& params, const float* cutoff, size_t i)
+    {
+        if constexpr (is_invariant<Cutoff>)
+            return cutoff_.sample(params);
+        else
+            return cutoff[i];
+    }
+
+    float res_at(const voice_parameters& params, const float* res, size_t i)
+    {
+        if constexpr (is_invariant<Res>)
+            return res_.sample(params);
+        else
+            return res[i];
+    }
+
+    auto children()
+    {
+        return std::tie(val_, cutoff_, res_);
+    }
+
+    [[no_unique_address]] hoisted_t<Val> val_;
+    [[no_unique_address]] hoisted_t<Cutoff> cutoff_;
+    [[no_unique_address]] hoisted_t<Res> res_;
+    float cutoff_seen_{-1.0f};
+    float res_seen_{-1.0f};
+};
+
+// 2-pole state variable filter; Cutoff in Hz, Res in [0, 1).
+template<typename Val, typename Cutoff, typename Res, typename Mode = lowpass>
+struct svf : filter_inputs<Val, Cutoff, Res>
+{
+    float sample(const voice_parameters& params)
+    {
+        float out;
+        process_block(params, &out, 1);
+        return out;
+    }
+
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float cutoff[max_block_size];
+        float res[max_block_size];
+        this->render(params, out, cutoff, res, frames);
+
+        if constexpr (!this->modulated)
+        {
+            if (this->changed(params))
+                svf_coefficients(prewarp(this->cutoff_seen_), this->res_seen_, k_, a1_, a2_, a3_);
+            run(out, frames);
+        }
+        else
+        {
+            for (size_t start = 0; start < frames; start += control_interval)
+            {
+                float g = fast_prewarp(this->cutoff_at(params, cutoff, start));
+                svf_coefficients(g, this->res_at(params, res, start), k_, a1_, a2_, a3_);
+                run(out + start, std::min(control_interval, frames - start));
+            }
+        }
+    }
+
+    // Locals, which out cannot alias, keep the state in registers.
+    void run(float* out, size_t frames)
+    {
+        float k = k_, a1 = a1_, a2 = a2_, a3 = a3_;
+        float ic1 = ic1_, ic2 = ic2_;
+
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = svf_tick<Mode>(out[i], k, a1, a2, a3, ic1, ic2);
+
+        ic1_ = ic1;
+        ic2_ = ic2;
+    }
+
+    float k_{2.0f};
+    float a1_{1.0f};
+    float a2_{0.0f};
+    float a3_{0.0f};
+    float ic1_{0.0f};
+    float ic2_{0.0f};
+};
+
+// 4-pole lowpass ladder; Cutoff in Hz, Res in [0, 1).
+template<typename Val, typename Cutoff, typename Res>
+struct ladder : filter_inputs<Val, Cutoff, Res>
+{
+    float sample(const voice_parameters& params)
+    {
+        float out;
+        process_block(params, &out, 1);
+        return out;
+    }
+
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float cutoff[max_block_size];
+        float res[max_block_size];
+        this->render(params, out, cutoff, res, frames);
+
+        if constexpr (!this->modulated)
+        {
+            if (this->changed(params))
+                ladder_coefficients(prewarp(this->cutoff_seen_), this->res_seen_, gain_, k_, norm_);
+            run(out, frames);
+        }
+        else
+        {
+            for (size_t start = 0; start < frames; start += control_interval)
+            {
+                float g = fast_prewarp(this->cutoff_at(params, cutoff, start));
+                ladder_coefficients(g, this->res_at(params, res, start), gain_, k_, norm_);
+                run(out + start, std::min(control_interval, frames - start));
+            }
+        }
+    }
+
+    void run(float* out, size_t frames)
+    {
+        float gain = gain_, k = k_, norm = norm_;
+        std::array<float, 4> s = s_;
+
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = ladder_tick(out[i], gain, k, norm, s[0], s[1], s[2], s[3]);
+
+        s_ = s;
+    }
+
+    float gain_{0.0f};
+    float k_{0.0f};
+    float norm_{1.0f};
+    std::array<float, 4> s_{};
+};
+
+// Voice-parallel filters keep coefficients and states per lane, so each
+// step runs across all lanes at once.
+template<typename Val, typename Cutoff, typename Res, size_t Lanes>
+struct lane_filter_inputs
+{
+    static constexpr bool modulated = !is_invariant<Cutoff> || !is_invariant<Res>;
+
+    void render(const lane_parameters<Lanes>& params, float* out, float* cutoff, float* res, size_t frames)
+    {
+        if constexpr (modulated)
+        {
+            cutoff_.process_block(params, cutoff, frames);
+            res_.process_block(params, res, frames);
+        }
+        val_.process_block(params, out, frames);
+    }
+
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        if constexpr (!modulated)
+        {
+            cutoff_seen_[lane] = evaluate_invariant<hoisted_t<Cutoff>>(params);
+            res_seen_[lane] = evaluate_invariant<hoisted_t<Res>>(params);
+        }
+    }
+
+    auto children()
+    {
+        return std::tie(val_, cutoff_, res_);
+    }
+
+    [[no_unique_address]] lane_batch<hoisted_t<Val>, Lanes> val_;
+    [[no_unique_address]] lane_batch<hoisted_t<Cutoff>, Lanes> cutoff_;
+    [[no_unique_address]] lane_batch<hoisted_t<Res>, Lanes> res_;
+    std::array<float, Lanes> cutoff_seen_{};
+    std::array<float, Lanes> res_seen_{};
+};
+
+template<typename Val, typename Cutoff, typename Res, typename Mode, size_t Lanes>
+struct lane_batch<svf<Val, Cutoff, Res, Mode>, Lanes> : lane_filter_inputs<Val, Cutoff, Res, Lanes>
+{
+    lane_batch()
+    {
+        k_.fill(2.0f);
+        a1_.fill(1.0f);
+    }
+
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float cutoff[lane_buffer_size];
+        float res[lane_buffer_size];
+        this->render(params, out, cutoff, res, frames);
+
+        if constexpr (!this->modulated)
+            run(out, frames);
+        else
+        {
+            for (size_t start = 0; start < frames; start += control_interval)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                {
+                    float g = fast_prewarp(cutoff[start * Lanes + l]);
+                    svf_coefficients(g, res[start * Lanes + l], k_[l], a1_[l], a2_[l], a3_[l]);
+                }
+                run(out + start * Lanes, std::min(control_interval, frames - start));
+            }
+        }
+    }
+
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        lane_filter_inputs<Val, Cutoff, Res, Lanes>::on_note(lane, params);
+        if constexpr (!this->modulated)
+            svf_coefficients(prewarp(this->cutoff_seen_[lane]), this->res_seen_[lane], k_[lane], a1_[lane], a2_[lane], a3_[lane]);
+    }
+
+    void reset(size_t lane)
+    {
+        ic1_[lane] = 0.0f;
+        ic2_[lane] = 0.0f;
+    }
+
+    void run(float* out, size_t frames)
+    {
+        std::array<float, Lanes> k = k_, a1 = a1_, a2 = a2_, a3 = a3_;
+        std::array<float, Lanes> ic1 = ic1_, ic2 = ic2_;
+
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+                out[i * Lanes + l] = svf_tick<Mode>(out[i * Lanes + l], k[l], a1[l], a2[l], a3[l], ic1[l], ic2[l]);
+        }
+
+        ic1_ = ic1;
+        ic2_ = ic2;
+    }
+
+    std::array<float, Lanes> k_;
+    std::array<float, Lanes> a1_;
+    std::array<float, Lanes> a2_{};
+    std::array<float, Lanes> a3_{};
+    std::array<float, Lanes> ic1_{};
+    std::array<float, Lanes> ic2_{};
+};
+
+template<typename Val, typename Cutoff, typename Res, size_t Lanes>
+struct lane_batch<ladder<Val, Cutoff, Res>, Lanes> : lane_filter_inputs<Val, Cutoff, Res, Lanes>
+{
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float cutoff[lane_buffer_size];
+        float res[lane_buffer_size];
+        this->render(params, out, cutoff, res, frames);
+
+        if constexpr (!this->modulated)
+            run(out, frames);
+        else
+        {
+            for (size_t start = 0; start < frames; start += control_interval)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                {
+                    float g = fast_prewarp(cutoff[start * Lanes + l]);
+                    ladder_coefficients(g, res[start * Lanes + l], gain_[l], k_[l], norm_[l]);
+                }
+                run(out + start * Lanes, std::min(control_interval, frames - start));
+            }
+        }
+    }
+
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        lane_filter_inputs<Val, Cutoff, Res, Lanes>::on_note(lane, params);
+        if constexpr (!this->modulated)
+            ladder_coefficients(prewarp(this->cutoff_seen_[lane]), this->res_seen_[lane], gain_[lane], k_[lane], norm_[lane]);
+    }
+
+    void reset(size_t lane)
+    {
+        for (auto& s : s_)
+            s[lane] = 0.0f;
+    }
+
+    void run(float* out, size_t frames)
+    {
+        std::array<float, Lanes> gain = gain_, k = k_, norm = norm_;
+        std::array<std::array<float, Lanes>, 4> s = s_;
+
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+                out[i * Lanes + l] = ladder_tick(out[i * Lanes + l], gain[l], k[l], norm[l], s[0][l], s[1][l], s[2][l], s[3][l]);
+        }
+
+        s_ = s;
+    }
+
+    std::array<float, Lanes> gain_{};
+    std::array<float, Lanes> k_{};
+    std::array<float, Lanes> norm_{};
+    std::array<std::array<float, Lanes>, 4> s_{};
+};
+
+}
+
+}
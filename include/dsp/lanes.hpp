@@ -0,0 +1,118 @@
+#pragma once
+
+#include <voice_parameters.hpp>
+#include <global_constants.hpp>
+
+#include "node.hpp"
+
+#include <array>
+
+namespace lyrid
+{
+ 
+namespace dsp
+{
+
+// Floats available to one lane block buffer, shared by all lanes.
+constexpr size_t lane_buffer_size = max_block_size * 4;
+
+template<size_t Lanes>
+constexpr size_t lane_block_frames = lane_buffer_size / Lanes;
+
+template<size_t Lanes>
+struct lane_parameters
+{
+    std::array<float, Lanes> base_freq_;
+    std::array<const voice_parameters*, Lanes> voices_;
+};
+
+// Node T running Lanes voices at once. Block buffers are frame-major,
+// sample i of lane l lives at out[i * Lanes + l].
+// The primary template keeps one scalar node per lane; vectorizable nodes
+// specialize it with structure-of-arrays state.
+template<typename T, size_t Lanes>
+struct lane_batch
+{
+    static constexpr bool scalar_fallback = true;
+    
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float lane_out[max_block_size];
+        
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            nodes_[l].process_block(*params.voices_[l], lane_out, frames);
+            for (size_t i = 0; i < frames; ++i)
+                out[i * Lanes + l] = lane_out[i];
+        }
+    }
+    
+    void reset(size_t lane)
+    {
+        T fresh;
+        keep_positional(fresh, nodes_[lane]);
+        nodes_[lane] = fresh;
+    }
+    
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        prepare(nodes_[lane], params);
+    }
+    
+    size_t quiet(const lane_parameters<Lanes>& params, size_t lane)
+    {
+        return quiet_frames(nodes_[lane], *params.voices_[lane]);
+    }
+    
+    std::array<T, Lanes> nodes_;
+};
+
+// Lane counterparts of dsp::quiet_frames, for one lane and for all of them.
+template<typename T, size_t Lanes>
+inline size_t quiet_frames(T& node, const lane_parameters<Lanes>& params, size_t lane)
+{
+    if constexpr (requires { node.quiet(params, lane); })
+        return node.quiet(params, lane);
+    else
+        return 0;
+}
+
+template<typename T, size_t Lanes>
+inline size_t quiet_frames(T& node, const lane_parameters<Lanes>& params)
+{
+    size_t quiet = always_quiet;
+    for (size_t l = 0; l < Lanes; ++l)
+        quiet = std::min(quiet, quiet_frames(node, params, l));
+    return quiet;
+}
+
+// Lane counterparts of dsp::prepare, plus the matching per-lane state reset.
+template<typename T>
+inline void prepare_lane(T& node, size_t lane, const voice_parameters& params)
+{
+    for_each_child(node, 
+        [&](auto& c)
+        {
+            prepare_lane(c, lane, params);
+        });
+    
+    if constexpr (requires { node.on_note(lane, params); })
+        node.on_note(lane, params);
+}
+
+template<typename T>
+inline void reset_lane(T& node, size_t lane)
+{
+    for_each_child(node, 
+        [&](auto& c)
+        {
+            reset_lane(c, lane);
+        });
+    
+    if constexpr (requires { node.reset(lane); })
+        node.reset(lane);
+}
+
+}
+
+}
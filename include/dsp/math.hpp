@@ -3,9 +3,11 @@
 #include <global_constants.hpp>
 
 #include <cmath>
+#include <cstdint>
 #include <numbers>
 #include <utility>
 #include <array>
+#include <algorithm>
 
 namespace lyrid
 {
@@ -30,6 +32,56 @@ inline T arr_sum(const std::array<T, I>& arr)
     return arr_sum_impl(arr, std::make_index_sequence<I>{});
 }
 
+// Wraps a phase in cycles from [-1, 2) back into [0, 1], enough for any
+// accumulator advanced by less than a cycle per sample. Two selects keep
+// the loop carried dependency short.
+inline float wrap_phase(float phase)
+{
+    phase = phase >= 1.0f ? phase - 1.0f : phase;
+    return phase < 0.0f ? phase + 1.0f : phase;
+}
+
+// sin(2 * pi * phase) for a phase in cycles, |phase| < 2^31. Folds into
+// [-1/4, 1/4] and evaluates an odd degree 9 minimax polynomial: absolute
+// error below 3e-7, no branches or library calls.
+inline float fast_sin(float phase)
+{
+    float x = phase - static_cast<float>(static_cast<int32_t>(phase + std::copysign(0.5f, phase)));
+    float a = std::fabs(x);
+    x = std::copysign(std::min(a, 0.5f - a), x);
+    
+    float x2 = x * x;
+    float p = 3.9536657230e+01f;
+    p = p * x2 - 7.6549775296e+01f;
+    p = p * x2 + 8.1601003737e+01f;
+    p = p * x2 - 4.1341655025e+01f;
+    p = p * x2 + 6.2831851601e+00f;
+    return p * x;
+}
+
+inline float cents_to_ratio(float cents)
+{
+    return std::pow(2.0, cents / 1200.0f);
+}
+
+inline void add_block(float* dst, const float* src, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i)
+        dst[i] += src[i];
+}
+
+inline void multiply_block(float* dst, const float* src, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i)
+        dst[i] *= src[i];
+}
+
+inline void scale_block(float* dst, float factor, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i)
+        dst[i] *= factor;
+}
+
 
 }
 
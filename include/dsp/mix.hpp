@@ -5,6 +5,10 @@
 
 #include <voice_parameters.hpp>
 
+#include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+
 namespace lyrid
 {
  
@@ -14,20 +18,87 @@ namespace dsp
 template<typename... Vals>
 struct mix
 {
+    static constexpr rate node_rate = max_rate<Vals...>;
+    
     inline float sample(const voice_parameters& params)
     {
-        auto arr = std::apply(
+        auto arr = vals_.apply(
             [&](auto&... val)
             {
                 return std::array{ val.sample(params)... };
-            }, 
-            vals_
+            }
         );
              
         return arr_sum(arr) / sizeof...(Vals);
     }
     
-    std::tuple<Vals...> vals_;
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float val[max_block_size];
+        std::fill_n(out, frames, 0.0f);
+        
+        vals_.apply(
+            [&](auto&... v)
+            {
+                ((v.process_block(params, val, frames), add_block(out, val, frames)), ...);
+            }
+        );
+        
+        scale_block(out, 1.0f / sizeof...(Vals), frames);
+    }
+    
+    size_t quiet(const voice_parameters& params)
+    {
+        return vals_.apply(
+            [&](auto&... v)
+            {
+                return std::min({ quiet_frames(v, params)... });
+            }
+        );
+    }
+    
+    auto children()
+    {
+        return tie_all(vals_);
+    }
+    
+    [[no_unique_address]] node_tuple<hoisted_t<Vals>...> vals_;
+};
+
+template<typename... Vals, size_t Lanes>
+struct lane_batch<mix<Vals...>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float val[lane_buffer_size];
+        std::fill_n(out, frames * Lanes, 0.0f);
+        
+        vals_.apply(
+            [&](auto&... v)
+            {
+                ((v.process_block(params, val, frames), add_block(out, val, frames * Lanes)), ...);
+            }
+        );
+        
+        scale_block(out, 1.0f / sizeof...(Vals), frames * Lanes);
+    }
+    
+    size_t quiet(const lane_parameters<Lanes>& params, size_t lane)
+    {
+        return vals_.apply(
+            [&](auto&... v)
+            {
+                return std::min({ quiet_frames(v, params, lane)... });
+            }
+        );
+    }
+    
+    auto children()
+    {
+        return tie_all(vals_);
+    }
+    
+    [[no_unique_address]] node_tuple<lane_batch<hoisted_t<Vals>, Lanes>...> vals_;
 };
 
 }
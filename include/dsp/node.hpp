@@ -0,0 +1,180 @@
+#pragma once
+
+#include <voice_parameters.hpp>
+
+#include "node_tuple.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+namespace lyrid
+{
+ 
+namespace dsp
+{
+
+// How often a node's output can change while a note plays, slowest first.
+enum class rate : uint8_t
+{
+    constant,
+    note,
+    control,
+    audio
+};
+
+template<typename T>
+concept has_rate = requires { T::node_rate; };
+
+template<typename T>
+constexpr rate rate_of = []
+{
+    if constexpr (has_rate<T>)
+        return T::node_rate;
+    else
+        return rate::audio;
+}();
+
+template<typename... Ts>
+constexpr rate max_rate = std::max({rate::constant, rate_of<Ts>...});
+
+template<typename T>
+constexpr bool is_invariant = rate_of<T> <= rate::note;
+
+// Composite nodes expose their inputs as a tuple of references.
+template<typename T>
+concept has_children = requires(T& t) { t.children(); };
+
+template<typename... Ts>
+inline auto tie_all(node_tuple<Ts...>& t)
+{
+    return t.apply(
+        [](auto&... v)
+        {
+            return std::tie(v...);
+        }
+    );
+}
+
+template<typename T, typename F>
+inline void for_each_child(T& node, F&& f)
+{
+    if constexpr (has_children<T>)
+    {
+        std::apply(
+            [&](auto&... c)
+            {
+                (f(c), ...);
+            },
+            node.children()
+        );
+    }
+}
+
+// Nodes whose state records where they sit in a voice rather than signal
+// state mark it with a positional member.
+template<typename T>
+concept positional = requires { T::positional; };
+
+// Carries the positional state of old over to fresh, so fresh can replace
+// old in place.
+template<typename T>
+inline void keep_positional(T& fresh, T& old)
+{
+    if constexpr (positional<T>)
+        fresh = old;
+    else if constexpr (has_children<T>)
+    {
+        auto to = fresh.children();
+        auto from = old.children();
+        [&]<size_t... I>(std::index_sequence<I...>)
+        {
+            (keep_positional(std::get<I>(to), std::get<I>(from)), ...);
+        }(std::make_index_sequence<std::tuple_size_v<decltype(to)>>{});
+    }
+}
+
+// Runs on_note() bottom-up through a tree, at note-on and whenever the
+// voice parameters change. Nodes cache their per-note values there.
+template<typename T>
+inline void prepare(T& node, const voice_parameters& params)
+{
+    for_each_child(node, 
+        [&](auto& c)
+        {
+            prepare(c, params);
+        });
+    
+    if constexpr (requires { node.on_note(params); })
+        node.on_note(params);
+}
+
+// Quiet span of a node that stays silent until its next note.
+constexpr size_t always_quiet = std::numeric_limits<size_t>::max();
+
+// Frames from now for which a node will output exactly zero, as far as it
+// can tell before rendering them; nodes opt in with quiet(). A quiet node
+// is still rendered, only work on its output may be skipped.
+template<typename T>
+inline size_t quiet_frames(T& node, const voice_parameters& params)
+{
+    if constexpr (requires { node.quiet(params); })
+        return node.quiet(params);
+    else
+        return 0;
+}
+
+// Value of an invariant subtree for one voice, from a freshly prepared instance.
+template<typename T>
+inline float evaluate_invariant(const voice_parameters& params)
+{
+    T node;
+    prepare(node, params);
+    return node.sample(params);
+}
+
+// Per-note constant subtree evaluated once in on_note().
+template<typename T>
+struct held
+{
+    static constexpr rate node_rate = rate_of<T>;
+    
+    inline float sample(const voice_parameters&)
+    {
+        return value_;
+    }
+    
+    inline void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        std::fill_n(out, frames, value_);
+    }
+    
+    void on_note(const voice_parameters& params)
+    {
+        value_ = node_.sample(params);
+    }
+    
+    size_t quiet(const voice_parameters&)
+    {
+        return value_ == 0.0f ? always_quiet : 0;
+    }
+    
+    auto children()
+    {
+        return std::tie(node_);
+    }
+    
+    [[no_unique_address]] T node_;
+    float value_{0.0f};
+};
+
+// Input member type: invariant composites are replaced by their cached value,
+// leaves are already as cheap as a cache.
+template<typename T>
+using hoisted_t = std::conditional_t<is_invariant<T> && has_children<T>, held<T>, T>;
+
+}
+
+}
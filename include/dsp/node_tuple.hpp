@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace lyrid
+{
+
+namespace dsp
+{
+
+template<size_t I, typename T>
+struct node_tuple_leaf
+{
+    [[no_unique_address]] T value_{};
+};
+
+template<typename Seq, typename... Ts>
+struct node_tuple_base;
+
+template<size_t... I, typename... Ts>
+struct node_tuple_base<std::index_sequence<I...>, Ts...> : node_tuple_leaf<I, Ts>...
+{};
+
+// Storage for the children of variadic nodes. Unlike std::tuple it is
+// trivially copyable whenever its elements are, so voice states built on it
+// can be reset by copying. Empty elements take no space.
+template<typename... Ts>
+struct node_tuple : node_tuple_base<std::index_sequence_for<Ts...>, Ts...>
+{
+    template<size_t I>
+    auto& get()
+    {
+        return leaf<I>(*this).value_;
+    }
+
+    // Calls f with every element, like std::apply.
+    template<typename F>
+    decltype(auto) apply(F&& f)
+    {
+        return [&]<size_t... I>(std::index_sequence<I...>) -> decltype(auto)
+        {
+            return f(get<I>()...);
+        }(std::index_sequence_for<Ts...>{});
+    }
+
+private:
+    template<size_t I, typename T>
+    static node_tuple_leaf<I, T>& leaf(node_tuple_leaf<I, T>& l)
+    {
+        return l;
+    }
+};
+
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "math.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace lyrid
+{
+
+namespace dsp
+{
+
+// Oscillator phase in cycles as a 32 bit fraction. Adding increments wraps
+// it for free, and its resolution does not depend on how long a note has
+// played.
+constexpr float phase_steps = 4294967296.0f;
+
+// The int32 range in floats, for the half resolution increments below.
+constexpr float min_half_steps = -2147483648.0f;
+constexpr float max_half_steps = 2147483520.0f;
+
+// Phase steps per sample at freq. Converted at half resolution, so that
+// frequencies below the sample rate fit a signed conversion, which
+// vectorizes; beyond that the increment is clamped rather than overflowing.
+// Loops read scale from phase_scale() once up front, since their stores
+// could alias the global.
+inline uint32_t phase_increment(float freq, float scale)
+{
+    float steps = std::min(std::max(freq * scale, min_half_steps), max_half_steps);
+    return static_cast<uint32_t>(static_cast<int32_t>(steps)) << 1;
+}
+
+inline float phase_scale()
+{
+    return rates().phase_scale_;
+}
+
+// Phase as cycles in [-0.5, 0.5): the same angle as the unsigned fraction,
+// through a signed conversion that vectorizes.
+inline float signed_phase(uint32_t phase)
+{
+    return static_cast<float>(static_cast<int32_t>(phase)) * (1.0f / phase_steps);
+}
+
+// Waveforms of a phase, each starting where the float generators did.
+// They are types so that nodes taking one stay plain type templates,
+// which dedup_t can look into.
+struct saw_wave
+{
+    static float at(uint32_t phase)
+    {
+        return static_cast<float>(static_cast<int32_t>(phase ^ 0x80000000u)) * (1.0f / 2147483648.0f);
+    }
+};
+
+struct square_wave
+{
+    static float at(uint32_t phase)
+    {
+        return static_cast<int32_t>(phase) < 0 ? 1.0f : -1.0f;
+    }
+};
+
+struct triangle_wave
+{
+    static float at(uint32_t phase)
+    {
+        return 1.0f - 2.0f * std::fabs(saw_wave::at(phase));
+    }
+};
+
+struct sine_wave
+{
+    static float at(uint32_t phase)
+    {
+        return std::sin(2 * std::numbers::pi_v<float> * signed_phase(phase));
+    }
+};
+
+struct fast_sine_wave
+{
+    static float at(uint32_t phase)
+    {
+        return fast_sin(signed_phase(phase));
+    }
+};
+
+}
+
+}
@@ -6,6 +6,8 @@
 #include <array>
 
 #include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
 
 namespace lyrid
 {
@@ -16,7 +18,7 @@ namespace dsp
 template<typename Coeff, size_t I>
 struct coeff_wrapper
 {
-    Coeff coeff_;
+    [[no_unique_address]] hoisted_t<Coeff> coeff_;
     static constexpr size_t power = I;
 };
 
@@ -27,7 +29,7 @@ struct coeff_tuple_type
 template<typename... Coeffs, size_t... I>
 struct coeff_tuple_type<std::tuple<Coeffs...>, std::index_sequence<I...>>
 {
-    using type = std::tuple<coeff_wrapper<Coeffs, I>...>;
+    using type = node_tuple<coeff_wrapper<Coeffs, I>...>;
 };
     
 template<typename... Coeffs>
@@ -46,32 +48,124 @@ void fill_powers(std::array<float, N>& arr, float x)
     fill_powers_impl(arr, x, std::make_index_sequence<N>{});
 }
 
+inline void accumulate_term(float* out, float* power, const float* coeff, const float* x, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i)
+    {
+        out[i] += coeff[i] * power[i];
+        power[i] *= x[i];
+    }
+}
+
+inline void accumulate_term(float* out, float* power, float coeff, const float* x, size_t frames)
+{
+    for (size_t i = 0; i < frames; ++i)
+    {
+        out[i] += coeff * power[i];
+        power[i] *= x[i];
+    }
+}
+
 template<typename Val, typename... Coeffs>
 struct polynomial
 {
+    static constexpr rate node_rate = max_rate<Val, Coeffs...>;
+    
     inline float sample(const voice_parameters& params)
     {
         std::array<float, sizeof...(Coeffs)> powers;
         fill_powers(powers, val_.sample(params));
         
-        auto arr = std::apply(
+        auto arr = coeffs_.apply(
             [&]<typename... Coeff, size_t... I>(coeff_wrapper<Coeff, I>&... c)
             {
                 return std::array{ c.coeff_.sample(params) * powers[I] ... };
-            }, 
-            coeffs_
+            }
         );
         
         return arr_sum(arr);
     }
     
-    Val val_;
-    coeff_tuple_t<Coeffs...> coeffs_;
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float x[max_block_size];
+        float power[max_block_size];
+        float coeff[max_block_size];
+        
+        val_.process_block(params, x, frames);
+        std::fill_n(out, frames, 0.0f);
+        std::fill_n(power, frames, 1.0f);
+        
+        auto add_term = [&]<typename Coeff, size_t I>(coeff_wrapper<Coeff, I>& c)
+        {
+            if constexpr (is_invariant<Coeff>)
+                accumulate_term(out, power, c.coeff_.sample(params), x, frames);
+            else
+            {
+                c.coeff_.process_block(params, coeff, frames);
+                accumulate_term(out, power, coeff, x, frames);
+            }
+        };
+        
+        coeffs_.apply(
+            [&](auto&... c)
+            {
+                (add_term(c), ...);
+            }
+        );
+    }
+    
+    auto children()
+    {
+        return std::tuple_cat(
+            std::tie(val_),
+            coeffs_.apply(
+                [](auto&... c)
+                {
+                    return std::tie(c.coeff_...);
+                }
+            )
+        );
+    }
+    
+    [[no_unique_address]] hoisted_t<Val> val_;
+    [[no_unique_address]] coeff_tuple_t<Coeffs...> coeffs_;
 };
 
 template<typename Val, typename Coeff0, typename Coeff1>
 using linear = polynomial<Val, Coeff0, Coeff1>;
 
+template<typename Val, typename... Coeffs, size_t Lanes>
+struct lane_batch<polynomial<Val, Coeffs...>, Lanes>
+{
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float x[lane_buffer_size];
+        float power[lane_buffer_size];
+        float coeff[lane_buffer_size];
+        size_t count = frames * Lanes;
+        
+        val_.process_block(params, x, frames);
+        std::fill_n(out, count, 0.0f);
+        std::fill_n(power, count, 1.0f);
+        
+        coeffs_.apply(
+            [&](auto&... c)
+            {
+                ((c.process_block(params, coeff, frames), accumulate_term(out, power, coeff, x, count)), ...);
+            }
+        );
+    }
+    
+    auto children()
+    {
+        return std::tuple_cat(std::tie(val_), tie_all(coeffs_));
+    }
+    
+    [[no_unique_address]] lane_batch<hoisted_t<Val>, Lanes> val_;
+    [[no_unique_address]] node_tuple<lane_batch<hoisted_t<Coeffs>, Lanes>...> coeffs_;
+};
+
 }
 
 }
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <voice_parameters.hpp>
+
+#include <tuple>
+#include <type_traits>
+#include <cstring>
+
+#include "node.hpp"
+#include "lanes.hpp"
+
+namespace lyrid
+{
+ 
+namespace dsp
+{
+
+// Output of a shared subtree for the block being rendered (block_) and for
+// the sample being rendered on the per-sample path (value_).
+struct shared_output
+{
+    const float* block_{nullptr};
+    float value_{0.0f};
+};
+
+// Reference to a subtree evaluated once per voice. Every shared<Node, Tag>
+// of a patch reads the same evaluation; Tag tells apart intentionally
+// separate copies of one structure. The slot is found through an offset
+// relative to the reference itself, so voice states stay relocatable.
+template<typename Node, typename Tag = void>
+struct shared
+{
+    using node_type = Node;
+    static constexpr rate node_rate = rate_of<Node>;
+    
+    // The binding belongs to the position of the reference in the voice.
+    static constexpr bool positional = true;
+    
+    inline float sample(const voice_parameters&)
+    {
+        return output().value_;
+    }
+    
+    inline void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        const float* src = output().block_ + lane_;
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = src[i * stride_];
+    }
+    
+    void bind(const shared_output& o, uint32_t stride, uint32_t lane)
+    {
+        offset_ = reinterpret_cast<const char*>(&o) - reinterpret_cast<const char*>(this);
+        stride_ = stride;
+        lane_ = lane;
+    }
+    
+    const shared_output& output() const
+    {
+        return *reinterpret_cast<const shared_output*>(reinterpret_cast<const char*>(this) + offset_);
+    }
+    
+    std::ptrdiff_t offset_{0};
+    uint32_t stride_{1};
+    uint32_t lane_{0};
+};
+
+template<typename Node, typename Tag, size_t Lanes>
+struct lane_batch<shared<Node, Tag>, Lanes>
+{
+    using ref_type = shared<Node, Tag>;
+    
+    inline void process_block(const lane_parameters<Lanes>&, float* out, size_t frames)
+    {
+        std::memcpy(out, output().block_, frames * Lanes * sizeof(float));
+    }
+    
+    void bind(const shared_output& o)
+    {
+        offset_ = reinterpret_cast<const char*>(&o) - reinterpret_cast<const char*>(this);
+    }
+    
+    const shared_output& output() const
+    {
+        return *reinterpret_cast<const shared_output*>(reinterpret_cast<const char*>(this) + offset_);
+    }
+    
+    std::ptrdiff_t offset_{0};
+};
+
+template<typename... Ts>
+struct type_list
+{};
+
+template<typename T, typename List>
+struct list_contains : std::false_type
+{};
+
+template<typename T, typename... Ts>
+struct list_contains<T, type_list<Ts...>> : std::bool_constant<(std::is_same_v<T, Ts> || ...)>
+{};
+
+template<typename T, typename List>
+struct list_index;
+
+template<typename T, typename... Ts>
+struct list_index<T, type_list<T, Ts...>> : std::integral_constant<size_t, 0>
+{};
+
+template<typename T, typename U, typename... Ts>
+struct list_index<T, type_list<U, Ts...>> : std::integral_constant<size_t, 1 + list_index<T, type_list<Ts...>>::value>
+{};
+
+template<typename... Lists>
+struct list_concat;
+
+template<>
+struct list_concat<>
+{
+    using type = type_list<>;
+};
+
+template<typename... Ts>
+struct list_concat<type_list<Ts...>>
+{
+    using type = type_list<Ts...>;
+};
+
+template<typename... Ts, typename... Us, typename... Rest>
+struct list_concat<type_list<Ts...>, type_list<Us...>, Rest...>
+{
+    using type = typename list_concat<type_list<Ts..., Us...>, Rest...>::type;
+};
+
+template<typename List, typename... Ts>
+struct list_append_unique
+{
+    using type = List;
+};
+
+template<typename... Ls, typename T, typename... Ts>
+struct list_append_unique<type_list<Ls...>, T, Ts...>
+{
+    using type = typename list_append_unique<
+        std::conditional_t<list_contains<T, type_list<Ls...>>::value, type_list<Ls...>, type_list<Ls..., T>>,
+        Ts...
+    >::type;
+};
+
+template<typename List>
+struct list_unique;
+
+template<typename... Ts>
+struct list_unique<type_list<Ts...>>
+{
+    using type = typename list_append_unique<type_list<>, Ts...>::type;
+};
+
+template<typename T>
+concept node = requires(T& t, const voice_parameters& p) { t.sample(p); };
+
+template<typename T>
+constexpr bool is_shared_ref = false;
+
+template<typename Node, typename Tag>
+constexpr bool is_shared_ref<shared<Node, Tag>> = true;
+
+// Every subtree of a node type, the node itself first.
+template<typename T>
+struct subtrees
+{
+    using type = std::conditional_t<node<T>, type_list<T>, type_list<>>;
+};
+
+template<template<typename...> class N, typename... Args>
+struct subtrees<N<Args...>>
+{
+    using type = std::conditional_t<
+        node<N<Args...>>,
+        typename list_concat<type_list<N<Args...>>, typename subtrees<Args>::type...>::type,
+        type_list<>
+    >;
+};
+
+template<typename T, typename List>
+struct list_count;
+
+template<typename T, typename... Ts>
+struct list_count<T, type_list<Ts...>> : std::integral_constant<size_t, (size_t(std::is_same_v<T, Ts>) + ... + 0)>
+{};
+
+// Subtrees worth sharing: repeated, stateful and changing while the note
+// plays. Invariant ones are already evaluated once per note.
+template<typename T, typename Root>
+constexpr bool is_shareable = node<T> && !is_shared_ref<T> && !std::is_empty_v<T> && !is_invariant<T>
+    && list_count<T, typename subtrees<Root>::type>::value > 1;
+
+template<typename T, typename Root>
+struct dedup
+{
+    using type = T;
+};
+
+template<typename T, typename Root>
+using dedup_arg_t = typename std::conditional_t<is_shareable<T, Root>, std::type_identity<shared<T>>, dedup<T, Root>>::type;
+
+template<template<typename...> class N, typename... Args, typename Root>
+struct dedup<N<Args...>, Root>
+{
+    using type = N<dedup_arg_t<Args, Root>...>;
+};
+
+template<typename Node, typename Tag, typename Root>
+struct dedup<shared<Node, Tag>, Root>
+{
+    using type = shared<Node, Tag>;
+};
+
+// Rewrites structurally identical repeated subtrees of T into shared<> references.
+template<typename T>
+using dedup_t = typename dedup<T, T>::type;
+
+// Shared references reachable from T, inner ones before the ones using them.
+template<typename T>
+struct collect_shared
+{
+    using type = type_list<>;
+};
+
+template<template<typename...> class N, typename... Args>
+struct collect_shared<N<Args...>>
+{
+    using type = typename list_concat<typename collect_shared<Args>::type...>::type;
+};
+
+template<typename Node, typename Tag>
+struct collect_shared<shared<Node, Tag>>
+{
+    using type = typename list_append_unique<typename collect_shared<Node>::type, shared<Node, Tag>>::type;
+};
+
+template<typename T>
+using shared_list_t = typename list_unique<typename collect_shared<T>::type>::type;
+
+template<typename Ref>
+struct shared_slot
+{
+    shared_output output_;
+    [[no_unique_address]] typename Ref::node_type node_;
+};
+
+template<typename Ref, size_t Lanes>
+struct lane_shared_slot
+{
+    shared_output output_;
+    [[no_unique_address]] lane_batch<typename Ref::node_type, Lanes> node_;
+};
+
+template<typename Slots, typename T>
+inline void bind_shared(Slots& slots, T& node, uint32_t stride, uint32_t lane)
+{
+    if constexpr (is_shared_ref<T>)
+        node.bind(slots.template output<T>(), stride, lane);
+    else if constexpr (requires { typename T::ref_type; })
+        node.bind(slots.template output<typename T::ref_type>());
+    else if constexpr (requires { T::scalar_fallback; })
+    {
+        for (size_t l = 0; l < node.nodes_.size(); ++l)
+            bind_shared(slots, node.nodes_[l], node.nodes_.size(), l);
+    }
+    else
+    {
+        for_each_child(node, 
+            [&](auto& c)
+            {
+                bind_shared(slots, c, stride, lane);
+            });
+    }
+}
+
+template<typename Tree, typename Shared>
+struct shared_root;
+
+// Voice state of a patch with shared subtrees: one slot per shared node,
+// evaluated in dependency order before the tree reads them.
+template<typename Tree, typename... Refs>
+struct shared_root<Tree, type_list<Refs...>>
+{
+    static constexpr rate node_rate = rate_of<Tree>;
+    
+    shared_root()
+    {
+        bind();
+    }
+    
+    inline float sample(const voice_parameters& params)
+    {
+        slots_.apply(
+            [&](auto&... slot)
+            {
+                ((slot.output_.value_ = slot.node_.sample(params)), ...);
+            }
+        );
+        return tree_.sample(params);
+    }
+    
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float blocks[sizeof...(Refs)][max_block_size];
+        size_t i = 0;
+        
+        slots_.apply(
+            [&](auto&... slot)
+            {
+                ((slot.node_.process_block(params, blocks[i], frames), slot.output_.block_ = blocks[i], ++i), ...);
+            }
+        );
+        tree_.process_block(params, out, frames);
+    }
+    
+    size_t quiet(const voice_parameters& params)
+    {
+        return quiet_frames(tree_, params);
+    }
+    
+    auto children()
+    {
+        return std::tuple_cat(
+            slots_.apply(
+                [](auto&... slot)
+                {
+                    return std::tie(slot.node_...);
+                }
+            ),
+            std::tie(tree_)
+        );
+    }
+    
+    template<typename Ref>
+    shared_output& output()
+    {
+        return slots_.template get<list_index<Ref, type_list<Refs...>>::value>().output_;
+    }
+    
+    void bind()
+    {
+        for_each_child(*this, 
+            [&](auto& c)
+            {
+                bind_shared(*this, c, 1, 0);
+            });
+    }
+    
+    [[no_unique_address]] node_tuple<shared_slot<Refs>...> slots_;
+    [[no_unique_address]] Tree tree_;
+};
+
+template<typename Tree, typename... Refs, size_t Lanes>
+struct lane_batch<shared_root<Tree, type_list<Refs...>>, Lanes>
+{
+    lane_batch()
+    {
+        bind();
+    }
+    
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float blocks[sizeof...(Refs)][lane_buffer_size];
+        size_t i = 0;
+        
+        slots_.apply(
+            [&](auto&... slot)
+            {
+                ((slot.node_.process_block(params, blocks[i], frames), slot.output_.block_ = blocks[i], ++i), ...);
+            }
+        );
+        tree_.process_block(params, out, frames);
+    }
+    
+    size_t quiet(const lane_parameters<Lanes>& params, size_t lane)
+    {
+        return quiet_frames(tree_, params, lane);
+    }
+    
+    auto children()
+    {
+        return std::tuple_cat(
+            slots_.apply(
+                [](auto&... slot)
+                {
+                    return std::tie(slot.node_...);
+                }
+            ),
+            std::tie(tree_)
+        );
+    }
+    
+    template<typename Ref>
+    shared_output& output()
+    {
+        return slots_.template get<list_index<Ref, type_list<Refs...>>::value>().output_;
+    }
+    
+    void bind()
+    {
+        for_each_child(*this, 
+            [&](auto& c)
+            {
+                bind_shared(*this, c, Lanes, 0);
+            });
+    }
+    
+    [[no_unique_address]] node_tuple<lane_shared_slot<Refs, Lanes>...> slots_;
+    [[no_unique_address]] lane_batch<Tree, Lanes> tree_;
+};
+
+// State type a patch is instantiated with: deduplicated, and rooted in
+// shared slots when it has any.
+template<typename Patch>
+using voice_type_t = std::conditional_t<
+    std::is_same_v<shared_list_t<dedup_t<Patch>>, type_list<>>,
+    dedup_t<Patch>,
+    shared_root<dedup_t<Patch>, shared_list_t<dedup_t<Patch>>>
+>;
+
+}
+
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+#include "wave_generators.hpp"
+#include "wavetable.hpp"
+#include <voice_parameters.hpp>
+
+#include <array>
+
+namespace lyrid
+{
+
+namespace dsp
+{
+
+// Phase to output of the oscillators unison can stack, matching the
+// standalone nodes. Tabled waves pick their mip level per block.
+template<typename Osc>
+struct unison_wave;
+
+template<typename Freq, typename Wave>
+struct unison_wave<oscillator<Freq, Wave>>
+{
+    static size_t level_for(float)
+    {
+        return 0;
+    }
+
+    static float at(size_t, uint32_t phase)
+    {
+        return Wave::at(phase);
+    }
+};
+
+template<typename Shape, typename Freq>
+struct unison_wave<wavetable_osc<Shape, Freq>>
+{
+    static size_t level_for(float increment)
+    {
+        return wavetable::level_for(increment);
+    }
+
+    static float at(size_t level, uint32_t phase)
+    {
+        return wavetable_for<Shape::value>().lookup(level, phase);
+    }
+};
+
+// N copies of Osc at Freq, detuned evenly across Spread cents and mixed
+// down like a mix of N oscillators. The copies' phases sit side by side so
+// the per-sample loop over them vectorizes, and their ratios are computed
+// once per note, or once per block for a Spread that moves.
+template<size_t N, template<typename> typename Osc, typename Freq, typename Spread>
+struct unison
+{
+    static_assert(N > 0, "unison needs at least one copy");
+
+    using wave = unison_wave<Osc<Freq>>;
+
+    unison()
+    {
+        ratio_.fill(1.0f);
+    }
+
+    float sample(const voice_parameters& params)
+    {
+        float out;
+        process_block(params, &out, 1);
+        return out;
+    }
+
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float freq[max_block_size];
+        if constexpr (is_invariant<Freq>)
+            std::fill_n(freq, frames, freq_.sample(params));
+        else
+            freq_.process_block(params, freq, frames);
+
+        if constexpr (!is_invariant<Spread>)
+            set_ratios(spread_.sample(params));
+
+        float max_freq = 0.0f;
+        for (size_t i = 0; i < frames; ++i)
+            max_freq = std::max(max_freq, std::fabs(freq[i]));
+        size_t level = wave::level_for(max_freq * std::max(ratio_[0], ratio_[N - 1]) * rates().sample_period_);
+
+        // One copy at a time: increments and waveform vectorize across the
+        // block, leaving only the integer running sum serial.
+        uint32_t phase[max_block_size];
+        float scale = phase_scale();
+        std::fill_n(out, frames, 0.0f);
+
+        for (size_t k = 0; k < N; ++k)
+        {
+            for (size_t i = 0; i < frames; ++i)
+                phase[i] = phase_increment(freq[i] * ratio_[k], scale);
+
+            uint32_t p = phase_[k];
+            for (size_t i = 0; i < frames; ++i)
+            {
+                p += phase[i];
+                phase[i] = p;
+            }
+            phase_[k] = p;
+
+            for (size_t i = 0; i < frames; ++i)
+                out[i] += wave::at(level, phase[i]);
+        }
+        scale_block(out, 1.0f / N, frames);
+    }
+
+    void on_note(const voice_parameters& params)
+    {
+        if constexpr (is_invariant<Spread>)
+            set_ratios(spread_.sample(params));
+    }
+
+    void set_ratios(float spread)
+    {
+        for (size_t k = 0; k < N; ++k)
+            ratio_[k] = copy_ratio(k, spread);
+    }
+
+    // Copies ascend in pitch, the outermost spread / 2 cents off Freq.
+    static float copy_ratio(size_t k, float spread)
+    {
+        float offset = N > 1 ? static_cast<float>(k) / (N - 1) - 0.5f : 0.0f;
+        return cents_to_ratio(spread * offset);
+    }
+
+    auto children()
+    {
+        return std::tie(freq_, spread_);
+    }
+
+    [[no_unique_address]] hoisted_t<Freq> freq_;
+    [[no_unique_address]] hoisted_t<Spread> spread_;
+    std::array<uint32_t, N> phase_{};
+    std::array<float, N> ratio_{};
+};
+
+// Lanes voices of unison at once: each copy's phases and ratios sit side
+// by side across the lanes, so every step of the copy loop runs over all
+// voices together. A moving Spread is read at the start of each block.
+template<size_t N, template<typename> typename Osc, typename Freq, typename Spread, size_t Lanes>
+struct lane_batch<unison<N, Osc, Freq, Spread>, Lanes>
+{
+    using node = unison<N, Osc, Freq, Spread>;
+    using wave = typename node::wave;
+
+    lane_batch()
+    {
+        for (auto& r : ratio_)
+            r.fill(1.0f);
+    }
+
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float freq[lane_buffer_size];
+        freq_.process_block(params, freq, frames);
+
+        if constexpr (!is_invariant<Spread>)
+        {
+            float spread[lane_buffer_size];
+            spread_.process_block(params, spread, frames);
+            for (size_t l = 0; l < Lanes; ++l)
+                set_ratios(l, spread[l]);
+        }
+
+        std::array<float, Lanes> max_freq{};
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+                max_freq[l] = std::max(max_freq[l], std::fabs(freq[i * Lanes + l]));
+        }
+
+        std::array<size_t, Lanes> level;
+        for (size_t l = 0; l < Lanes; ++l)
+            level[l] = wave::level_for(max_freq[l] * std::max(ratio_[0][l], ratio_[N - 1][l]) * rates().sample_period_);
+
+        float scale = phase_scale();
+        std::fill_n(out, frames * Lanes, 0.0f);
+
+        // Phases first, then waveforms, so table lookups that cannot
+        // vectorize stay out of the phase loop.
+        uint32_t phase[lane_buffer_size];
+
+        for (size_t k = 0; k < N; ++k)
+        {
+            std::array<uint32_t, Lanes> p = phase_[k];
+            const std::array<float, Lanes>& ratio = ratio_[k];
+
+            for (size_t i = 0; i < frames; ++i)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                {
+                    p[l] += phase_increment(freq[i * Lanes + l] * ratio[l], scale);
+                    phase[i * Lanes + l] = p[l];
+                }
+            }
+            phase_[k] = p;
+
+            for (size_t i = 0; i < frames; ++i)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                    out[i * Lanes + l] += wave::at(level[l], phase[i * Lanes + l]);
+            }
+        }
+        scale_block(out, 1.0f / N, frames * Lanes);
+    }
+
+    void on_note(size_t lane, const voice_parameters& params)
+    {
+        if constexpr (is_invariant<Spread>)
+            set_ratios(lane, evaluate_invariant<hoisted_t<Spread>>(params));
+    }
+
+    void reset(size_t lane)
+    {
+        for (size_t k = 0; k < N; ++k)
+        {
+            phase_[k][lane] = 0;
+            ratio_[k][lane] = 1.0f;
+        }
+    }
+
+    void set_ratios(size_t lane, float spread)
+    {
+        for (size_t k = 0; k < N; ++k)
+            ratio_[k][lane] = node::copy_ratio(k, spread);
+    }
+
+    auto children()
+    {
+        return std::tie(freq_, spread_);
+    }
+
+    [[no_unique_address]] lane_batch<hoisted_t<Freq>, Lanes> freq_;
+    [[no_unique_address]] lane_batch<hoisted_t<Spread>, Lanes> spread_;
+    std::array<std::array<uint32_t, Lanes>, N> phase_{};
+    std::array<std::array<float, Lanes>, N> ratio_{};
+};
+
+}
+
+}
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
 #include <voice_parameters.hpp>
 
+#include <algorithm>
+#include <array>
+
 namespace lyrid
 {
  
@@ -12,13 +17,135 @@ namespace dsp
 template<typename Val, typename Vol>
 struct volume
 {
+    static constexpr rate node_rate = max_rate<Val, Vol>;
+    
+    // Val is not rendered while Vol is quiet, and starts over from its
+    // note's start where Vol's quiet span ends. What it rendered before the
+    // span, and in lanes mode for neighbouring voices, makes no difference.
     inline float sample(const voice_parameters& params)
     {
+        size_t quiet = quiet_frames(vol_, params);
+        if (quiet > 0)
+        {
+            vol_.sample(params);
+            if (quiet == 1)
+                restart_val(params);
+            return 0.0f;
+        }
         return val_.sample(params) * pow4(vol_.sample(params));
     }
     
-    Val val_;
-    Vol vol_;
+    inline void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        if constexpr (is_invariant<Vol>)
+        {
+            val_.process_block(params, out, frames);
+            scale_block(out, pow4(vol_.sample(params)), frames);
+        }
+        else
+        {
+            size_t span = quiet_frames(vol_, params);
+            size_t quiet = std::min({span, frames, max_block_size});
+            std::fill_n(out, quiet, 0.0f);
+            if (span > 0 && span <= frames)
+                restart_val(params);
+            if (quiet < frames)
+                val_.process_block(params, out + quiet, frames - quiet);
+            
+            float vol[max_block_size];
+            vol_.process_block(params, vol, frames);
+            
+            for (size_t i = quiet; i < frames; ++i)
+                out[i] *= pow4(vol[i]);
+        }
+    }
+    
+    // While Vol is quiet Val's own span says nothing, it restarts after.
+    size_t quiet(const voice_parameters& params)
+    {
+        size_t vol = quiet_frames(vol_, params);
+        return vol > 0 ? vol : quiet_frames(val_, params);
+    }
+    
+    auto children()
+    {
+        return std::tie(val_, vol_);
+    }
+    
+    void restart_val(const voice_parameters& params)
+    {
+        hoisted_t<Val> fresh;
+        keep_positional(fresh, val_);
+        val_ = fresh;
+        prepare(val_, params);
+    }
+    
+    [[no_unique_address]] hoisted_t<Val> val_;
+    [[no_unique_address]] hoisted_t<Vol> vol_;
+};
+
+template<typename Val, typename Vol, size_t Lanes>
+struct lane_batch<volume<Val, Vol>, Lanes>
+{
+    // Val renders for the whole group unless every lane is quiet, so a quiet
+    // lane's Val may run on for its neighbours. The block is split wherever
+    // a lane's quiet span ends, and that lane's Val restarts there, as in
+    // the scalar volume.
+    inline void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        for (size_t done = 0; done < frames;)
+        {
+            std::array<size_t, Lanes> quiet;
+            size_t all = always_quiet;
+            size_t span = frames - done;
+            for (size_t l = 0; l < Lanes; ++l)
+            {
+                quiet[l] = quiet_frames(vol_, params, l);
+                all = std::min(all, quiet[l]);
+                if (quiet[l] > 0)
+                    span = std::min(span, quiet[l]);
+            }
+            
+            float* dst = out + done * Lanes;
+            if (all > 0)
+                std::fill_n(dst, span * Lanes, 0.0f);
+            else
+                val_.process_block(params, dst, span);
+            
+            float vol[lane_buffer_size];
+            vol_.process_block(params, vol, span);
+            
+            for (size_t i = 0; i < span; ++i)
+            {
+                for (size_t l = 0; l < Lanes; ++l)
+                    dst[i * Lanes + l] = quiet[l] > 0 ? 0.0f : dst[i * Lanes + l] * pow4(vol[i * Lanes + l]);
+            }
+            
+            for (size_t l = 0; l < Lanes; ++l)
+            {
+                if (quiet[l] == span)
+                {
+                    reset_lane(val_, l);
+                    prepare_lane(val_, l, *params.voices_[l]);
+                }
+            }
+            done += span;
+        }
+    }
+    
+    size_t quiet(const lane_parameters<Lanes>& params, size_t lane)
+    {
+        size_t vol = quiet_frames(vol_, params, lane);
+        return vol > 0 ? vol : quiet_frames(val_, params, lane);
+    }
+    
+    auto children()
+    {
+        return std::tie(val_, vol_);
+    }
+    
+    [[no_unique_address]] lane_batch<hoisted_t<Val>, Lanes> val_;
+    [[no_unique_address]] lane_batch<hoisted_t<Vol>, Lanes> vol_;
 };
 
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+#include "phase.hpp"
 #include <voice_parameters.hpp>
 
 namespace lyrid
@@ -9,95 +12,70 @@ namespace lyrid
 namespace dsp
 {
     
-template<typename Freq>
-struct sine
+// Phase accumulator behind every periodic waveform here. Wave derives the
+// output from the fixed point phase, so the loops carry no branches or
+// divisions, and a per-note frequency is converted to an increment once
+// per block.
+template<typename Freq, typename Wave>
+struct oscillator
 {
-    sine():
-        phase_(0.0)
-    {}
- 
     float sample(const voice_parameters& params)
     {
-        double increment = 2 * std::numbers::pi * freq_.sample(params) / sample_rate;
-        phase_ += increment;
-        return std::sin(phase_);
+        phase_ += phase_increment(freq_.sample(params), phase_scale());
+        return Wave::at(phase_);
     }
-
-    Freq freq_;
-    double phase_;
-};
-
-template<typename Freq>
-struct square
-{
-    square():
-        time_(0.0), val_(-1.0f)
-    {}
- 
-    float sample(const voice_parameters& params)
+    
+    void process_block(const voice_parameters& params, float* out, size_t frames)
     {
-        float f = freq_.sample(params);
-        time_ += 1.0 / sample_rate;
-        float half_period = 1.0 / (f * 2);
+        if constexpr (is_invariant<Freq>)
+        {
+            uint32_t increment = phase_increment(freq_.sample(params), phase_scale());
+            for (size_t i = 0; i < frames; ++i)
+                out[i] = Wave::at(phase_ + increment * static_cast<uint32_t>(i + 1));
+            phase_ += increment * static_cast<uint32_t>(frames);
+            return;
+        }
+        
+        float freq[max_block_size];
+        uint32_t phase[max_block_size];
+        freq_.process_block(params, freq, frames);
         
-        if (time_ >= half_period)
+        // The running sum first, the waveform then runs as a separate vectorizable pass.
+        float scale = phase_scale();
+        for (size_t i = 0; i < frames; ++i)
         {
-            time_ -= half_period;
-            val_ = -val_;
+            phase_ += phase_increment(freq[i], scale);
+            phase[i] = phase_;
         }
-        return val_;
+        
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = Wave::at(phase[i]);
     }
 
-    Freq freq_;
-    float time_;
-    float val_;
+    auto children()
+    {
+        return std::tie(freq_);
+    }
+    
+    [[no_unique_address]] hoisted_t<Freq> freq_;
+    uint32_t phase_{0};
 };
 
 template<typename Freq>
-struct saw
-{
-    saw():
-        phase_(0.0)
-    {}
- 
-    float sample(const voice_parameters& params)
-    {
-        float f = freq_.sample(params);
-        float increment = f / sample_rate;
-        phase_ += increment;
-        if (phase_ >= 1.0) 
-            phase_ -= 1.0;
-        return 2.0 * phase_ - 1.0;
-    }
+using sine = oscillator<Freq, sine_wave>;
 
-    Freq freq_;
-    float phase_;
-};
+// Sine evaluated with fast_sin.
+template<typename Freq>
+using fast_sine = oscillator<Freq, fast_sine_wave>;
 
 template<typename Freq>
-struct triangle
-{
-    triangle():
-        phase_(0.0)
-    {}
- 
-    float sample(const voice_parameters& params)
-    {
-        float f = freq_.sample(params);
-        float increment = f / sample_rate;
-        phase_ += increment;
-        if (phase_ >= 1.0)
-            phase_ -= 1.0;
-
-        if (phase_ < 0.5)
-            return 4.0 * phase_ - 1.0;
-        else
-            return -4.0 * phase_ + 3.0;
-    }
+using square = oscillator<Freq, square_wave>;
 
-    Freq freq_;
-    float phase_;
-};
+template<typename Freq>
+using saw = oscillator<Freq, saw_wave>;
+
+template<typename Freq>
+using triangle = oscillator<Freq, triangle_wave>;
 
 class white_noise
 {
@@ -111,6 +89,12 @@ public:
         return sample();
     }
     
+    void process_block(const voice_parameters&, float* out, size_t frames)
+    {
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = sample();
+    }
+    
     float sample()
     {
         // Xorshift* (Daniel Lemire / Sebastiano Vigna)
@@ -151,13 +135,51 @@ public:
 
         return (arr_sum(b_) + white * 0.5362f) * 0.11f;
     }
+    
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        for (size_t i = 0; i < frames; ++i)
+            out[i] = sample(params);
+    }
 
 private:
     white_noise white_gen_;
     std::array<float, 7> b_;
 };
 
-}
+template<typename Freq, typename Wave, size_t Lanes>
+struct lane_batch<oscillator<Freq, Wave>, Lanes>
+{
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        float freq[lane_buffer_size];
+        freq_.process_block(params, freq, frames);
+        
+        float scale = phase_scale();
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+            {
+                phase_[l] += phase_increment(freq[i * Lanes + l], scale);
+                out[i * Lanes + l] = Wave::at(phase_[l]);
+            }
+        }
+    }
+    
+    void reset(size_t lane)
+    {
+        phase_[lane] = 0;
+    }
+    
+    auto children()
+    {
+        return std::tie(freq_);
+    }
+    
+    [[no_unique_address]] lane_batch<hoisted_t<Freq>, Lanes> freq_;
+    std::array<uint32_t, Lanes> phase_{};
+};
 
 }
 
+}
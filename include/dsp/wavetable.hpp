@@ -0,0 +1,226 @@
+#pragma once
+
+#include "math.hpp"
+#include "node.hpp"
+#include "lanes.hpp"
+#include "phase.hpp"
+#include <voice_parameters.hpp>
+
+#include <bit>
+#include <cstdint>
+#include <type_traits>
+
+namespace lyrid
+{
+ 
+namespace dsp
+{
+
+enum class wave_shape : uint8_t
+{
+    saw,
+    square,
+    triangle
+};
+
+// Mip-mapped single cycle tables, one per octave. Level k holds the first
+// max_harmonics >> k harmonics, so it is alias-free up to a phase increment
+// of 0.5 / (max_harmonics >> k) cycles per sample. Tables are independent of
+// the sample rate and carry one guard sample for interpolation.
+class wavetable
+{
+public:
+    static constexpr size_t size = 2048;
+    static constexpr size_t levels = 11;
+    static constexpr size_t max_harmonics = size / 2;
+    
+    explicit wavetable(wave_shape shape)
+    {
+        std::array<double, size> sin_table;
+        for (size_t n = 0; n < size; ++n)
+            sin_table[n] = std::sin(2.0 * std::numbers::pi * n / size);
+        
+        // Built from the top level down, each level adds the harmonics the
+        // next one up left out.
+        std::array<double, size> acc{};
+        size_t harmonic = 1;
+        
+        for (size_t level = levels; level-- > 0;)
+        {
+            size_t count = max_harmonics >> level;
+            for (; harmonic <= count; ++harmonic)
+                add_harmonic(acc, sin_table, shape, harmonic);
+            
+            for (size_t n = 0; n < size; ++n)
+                tables_[level][n] = static_cast<float>(acc[n]);
+            tables_[level][size] = tables_[level][0];
+        }
+    }
+    
+    // Level for the highest phase increment a block will use.
+    static size_t level_for(float increment)
+    {
+        uint32_t steps = static_cast<uint32_t>(std::fabs(increment) * 2 * max_harmonics);
+        return std::min<size_t>(std::bit_width(steps), levels - 1);
+    }
+    
+    // Linearly interpolated lookup at a fixed point phase: the top bits
+    // index the table, the rest interpolate.
+    float lookup(size_t level, uint32_t phase) const
+    {
+        constexpr uint32_t frac_bits = 32 - std::bit_width(size - 1);
+        
+        const float* t = tables_[level].data() + (phase >> frac_bits);
+        float frac = static_cast<float>(static_cast<int32_t>(phase & ((1u << frac_bits) - 1))) * (1.0f / (1u << frac_bits));
+        return t[0] + (t[1] - t[0]) * frac;
+    }
+    
+private:
+    static void add_harmonic(std::array<double, size>& acc, const std::array<double, size>& sin_table, wave_shape shape, size_t k)
+    {
+        double amp = 0.0;
+        size_t offset = 0;
+        
+        switch (shape)
+        {
+            case wave_shape::saw:
+                amp = -2.0 / (std::numbers::pi * k);
+                break;
+            case wave_shape::square:
+                amp = (k % 2) ? -4.0 / (std::numbers::pi * k) : 0.0;
+                break;
+            case wave_shape::triangle:
+                amp = (k % 2) ? -8.0 / (std::numbers::pi * std::numbers::pi * k * k) : 0.0;
+                offset = size / 4;
+                break;
+        }
+        
+        if (amp == 0.0)
+            return;
+        
+        for (size_t n = 0; n < size; ++n)
+            acc[n] += amp * sin_table[(k * n + offset) % size];
+    }
+    
+    std::array<std::array<float, size + 1>, levels> tables_;
+};
+
+// Computed during static initialization, shared by every voice.
+inline const wavetable saw_wavetable{wave_shape::saw};
+inline const wavetable square_wavetable{wave_shape::square};
+inline const wavetable triangle_wavetable{wave_shape::triangle};
+
+template<wave_shape Shape>
+inline const wavetable& wavetable_for()
+{
+    if constexpr (Shape == wave_shape::saw)
+        return saw_wavetable;
+    else if constexpr (Shape == wave_shape::square)
+        return square_wavetable;
+    else
+        return triangle_wavetable;
+}
+
+// Shape as a type, keeping wavetable_osc a plain type template for dedup_t.
+template<wave_shape Shape>
+using shape_constant = std::integral_constant<wave_shape, Shape>;
+
+// Band-limited oscillator, phase aligned with the naive generator of the same shape.
+template<typename Shape, typename Freq>
+struct wavetable_osc
+{
+    float sample(const voice_parameters& params)
+    {
+        float freq = freq_.sample(params);
+        phase_ += phase_increment(freq, phase_scale());
+        return wavetable_for<Shape::value>().lookup(wavetable::level_for(freq * rates().sample_period_), phase_);
+    }
+    
+    void process_block(const voice_parameters& params, float* out, size_t frames)
+    {
+        float freq[max_block_size];
+        if constexpr (is_invariant<Freq>)
+            std::fill_n(freq, frames, freq_.sample(params));
+        else
+            freq_.process_block(params, freq, frames);
+        
+        float max_freq = 0.0f;
+        for (size_t i = 0; i < frames; ++i)
+            max_freq = std::max(max_freq, std::fabs(freq[i]));
+        size_t level = wavetable::level_for(max_freq * rates().sample_period_);
+        
+        const wavetable& table = wavetable_for<Shape::value>();
+        float scale = phase_scale();
+        for (size_t i = 0; i < frames; ++i)
+        {
+            phase_ += phase_increment(freq[i], scale);
+            out[i] = table.lookup(level, phase_);
+        }
+    }
+    
+    auto children()
+    {
+        return std::tie(freq_);
+    }
+    
+    [[no_unique_address]] hoisted_t<Freq> freq_;
+    uint32_t phase_{0};
+};
+
+template<typename Freq>
+using bl_saw = wavetable_osc<shape_constant<wave_shape::saw>, Freq>;
+
+template<typename Freq>
+using bl_square = wavetable_osc<shape_constant<wave_shape::square>, Freq>;
+
+template<typename Freq>
+using bl_triangle = wavetable_osc<shape_constant<wave_shape::triangle>, Freq>;
+
+template<typename Shape, typename Freq, size_t Lanes>
+struct lane_batch<wavetable_osc<Shape, Freq>, Lanes>
+{
+    void process_block(const lane_parameters<Lanes>& params, float* out, size_t frames)
+    {
+        const wavetable& table = wavetable_for<Shape::value>();
+        float freq[lane_buffer_size];
+        freq_.process_block(params, freq, frames);
+        
+        std::array<float, Lanes> max_freq{};
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+                max_freq[l] = std::max(max_freq[l], std::fabs(freq[i * Lanes + l]));
+        }
+        
+        std::array<size_t, Lanes> level;
+        for (size_t l = 0; l < Lanes; ++l)
+            level[l] = wavetable::level_for(max_freq[l] * rates().sample_period_);
+        
+        float scale = phase_scale();
+        for (size_t i = 0; i < frames; ++i)
+        {
+            for (size_t l = 0; l < Lanes; ++l)
+            {
+                phase_[l] += phase_increment(freq[i * Lanes + l], scale);
+                out[i * Lanes + l] = table.lookup(level[l], phase_[l]);
+            }
+        }
+    }
+    
+    void reset(size_t lane)
+    {
+        phase_[lane] = 0;
+    }
+    
+    auto children()
+    {
+        return std::tie(freq_);
+    }
+    
+    [[no_unique_address]] lane_batch<hoisted_t<Freq>, Lanes> freq_;
+    std::array<uint32_t, Lanes> phase_{};
+};
+
+}
+
+}
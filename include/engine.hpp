@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "global_constants.hpp"
+#include "patch.hpp"
+#include "poly_instrument.hpp"
+#include "worker_pool.hpp"
+
+namespace lyrid
+{
+
+// Multi-timbral host: instruments, each with its own patch, feed a tree of
+// stereo buses ending in the master bus. Every block renders the instruments
+// as parallel tasks; a bus is mixed by whichever task finishes its last input,
+// so the graph runs as a dependency DAG with no stage waiting on another
+// thread's loop. Each stage reads its inputs' buffers in place.
+class engine
+{
+public:
+    static constexpr size_t master_bus = 0;
+
+    // Without a pool everything renders on the calling thread, in the same order.
+    explicit engine(worker_pool* pool = nullptr);
+
+    engine(const engine&) = delete;
+    engine& operator=(const engine&) = delete;
+
+    // Graph setup, before rendering starts. Buses must be added after their parent.
+    size_t add_bus(size_t parent = master_bus, float gain = 1.0f, float pan = 0.0f);
+
+    // With several instruments each renders as one pool task. A lone instrument
+    // is handed the pool instead and spreads its voices over it.
+    size_t add_instrument(size_t max_voices, patch p, size_t bus = master_bus, render_mode mode = render_mode::scalar, float gain = 1.0f, float pan = 0.0f);
+
+    poly_instrument& instrument(size_t idx)
+    {
+        return *sources_[idx]->instr_;
+    }
+
+    size_t instrument_count() const
+    {
+        return sources_.size();
+    }
+
+    size_t bus_count() const
+    {
+        return buses_.size();
+    }
+
+    // Any thread, picked up by the next block. Pan runs from -1 (left) to 1 (right).
+    void set_instrument_mix(size_t idx, float gain, float pan);
+    void set_bus_mix(size_t idx, float gain, float pan);
+
+    // Interleaved stereo.
+    void render(float* out, size_t frames);
+
+private:
+    static constexpr size_t no_bus = size_t(-1);
+
+    struct mix_params
+    {
+        std::atomic<float> gain_{1.0f};
+        std::atomic<float> pan_{0.0f};
+    };
+
+    struct alignas(cache_line_size) source
+    {
+        std::unique_ptr<poly_instrument> instr_;
+        size_t bus_;
+        mix_params mix_;
+        float out_[max_block_size];
+    };
+
+    struct alignas(cache_line_size) bus
+    {
+        size_t parent_;
+        std::vector<size_t> sources_;
+        std::vector<size_t> buses_;
+        mix_params mix_;
+        std::atomic<size_t> pending_{0};
+        float left_[max_block_size];
+        float right_[max_block_size];
+    };
+
+    static void render_source_task(void* ctx, size_t i);
+
+    void render_block(float* out, size_t frames);
+    void render_source(size_t idx);
+    void input_done(size_t bus_idx);
+    void mix_bus(size_t bus_idx);
+
+    worker_pool* pool_;
+    std::vector<std::unique_ptr<source>> sources_;
+    std::vector<std::unique_ptr<bus>> buses_;
+    size_t frames_{0};
+};
+
+}
@@ -1,11 +1,49 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 
 namespace lyrid
 {
-    
-constexpr uint64_t sample_rate = 48000;
 
+// Rate used until a device reports its own.
+constexpr uint32_t default_sample_rate = 48000;
+constexpr size_t max_block_size = 256;
+constexpr size_t cache_line_size = 64;
+
+// Everything the nodes derive from the sample rate, worked out once when the
+// rate is set so the hot loops multiply by a loaded constant instead of
+// dividing.
+struct rate_constants
+{
+    uint32_t sample_rate_;
+    float sample_period_;
+    // Phase steps per hertz at half resolution, see dsp::phase_increment.
+    float phase_scale_;
+};
+
+constexpr rate_constants make_rate_constants(uint32_t rate)
+{
+    return rate_constants{rate, 1.0f / rate, 2147483648.0f / rate};
+}
+
+// The engine's rate. Set before rendering starts: voices read it without
+// synchronization.
+inline rate_constants current_rate = make_rate_constants(default_sample_rate);
+
+inline const rate_constants& rates()
+{
+    return current_rate;
 }
 
+inline uint32_t sample_rate()
+{
+    return current_rate.sample_rate_;
+}
+
+inline void set_sample_rate(uint32_t rate)
+{
+    current_rate = make_rate_constants(rate);
+}
+
+}
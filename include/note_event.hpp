@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lyrid
+{
+
+enum class event_type : uint8_t { note_on, note_off, set_freq };
+
+// time_ is the absolute frame on the renderer's timeline; events at or before
+// the current frame apply at the start of the next block.
+struct note_event
+{
+    event_type type_;
+    uint64_t time_;
+    uint64_t id_;
+    float value_;
+};
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <vector>
+
+namespace lyrid
+{
+
+class poly_instrument;
+struct score;
+
+struct render_stats
+{
+    size_t frames_;
+    double seconds_;
+    
+    double audio_seconds() const;
+    double real_time_factor() const;
+};
+
+// Drives a poly_instrument without an audio device, as fast as the CPU allows.
+class offline_renderer
+{
+public:
+    offline_renderer(poly_instrument& instr);
+    
+    render_stats render(std::span<float> out);
+    render_stats render_to_wav(const std::string& path, size_t frames);
+    
+    // Plays s from the instrument's current frame, which should be 0, feeding
+    // its events a chunk ahead of the renderer.
+    render_stats render_score(const score& s, const std::string& path);
+    
+private:
+    poly_instrument& instr_;
+    std::vector<float> chunk_;
+};
+
+}
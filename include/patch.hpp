@@ -1,20 +1,53 @@
 #pragma once
 
+#include <cstddef>
+
 namespace lyrid
 {
     
 struct voice_parameters;
 
 using sampler = float (*)(const voice_parameters&, void*);
+using block_sampler = void (*)(const voice_parameters&, void*, float*, size_t);
+using lane_sampler = void (*)(const voice_parameters*, void*, float*, size_t);
+using lane_reset = void (*)(void*, size_t);
+using note_hook = void (*)(const voice_parameters&, void*);
+using lane_note_hook = void (*)(const voice_parameters&, void*, size_t);
+using quiet_hint = size_t (*)(const voice_parameters&, void*);
+using lane_quiet_hint = size_t (*)(const voice_parameters*, void*, size_t);
 using in_place_constructor = void (*)(void*);
-using destructor = void (*)(void*);
+using state_reset = void (*)(void*);
+using state_bind = void (*)(void*, const void*);
 
+// Voice-parallel form of a patch: one state renders lanes_ consecutive voices,
+// frame-major into out[i * lanes_ + lane].
+struct lane_kernel
+{
+    size_t lanes_;
+    lane_sampler sampler_;
+    lane_reset reset_;
+    lane_note_hook prepare_;
+    lane_quiet_hint quiet_;
+    in_place_constructor cnstr_;
+    size_t state_size_;
+    state_bind bind_{nullptr};
+};
+
+// Voice states are trivially copyable and destructible: reset_ turns any
+// state_size_ bytes, initialized or not, into a voice about to start.
+// Patches built from data set bind_, which ties freshly allocated state
+// memory to data_ once, before any other call.
 struct patch
 {
     sampler sampler_;
-    in_place_constructor cnstr_;
-    destructor dstr_;
+    block_sampler block_sampler_;
+    note_hook prepare_;
+    quiet_hint quiet_;
+    state_reset reset_;
     size_t state_size_;
+    lane_kernel lanes_;
+    state_bind bind_{nullptr};
+    const void* data_{nullptr};
 };
 
 }
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "patch.hpp"
+#include "voice_parameters.hpp"
+
+namespace lyrid
+{
+
+class patch_compiler;
+struct patch_kernels;
+
+// Patch described as text and compiled at load time into a flat,
+// register allocated program over the dsp nodes, run a block at a time by
+// an interpreter. The text spells out the same trees as the template
+// patches, with optional definitions and # comments:
+//
+//     vibrato = linear(lfo(7), base_freq, 5)
+//     volume(mix(saw(detune(vibrato, -8)), saw(vibrato)), envelope_ar(0.5, 5))
+//
+// Identical subtrees are evaluated once per voice and per-note subtrees
+// once per note, as dedup_t and hoisted_t do for templates. Voice states
+// refer back to the program, so it must outlive every instrument playing it.
+class patch_program
+{
+public:
+    static constexpr size_t max_registers = 16;
+    static constexpr size_t max_scopes = 16;
+    static constexpr size_t max_args = 64;
+
+    // Throws std::runtime_error naming the offending line.
+    explicit patch_program(std::string_view source);
+
+    patch_program(const patch_program&) = delete;
+    patch_program& operator=(const patch_program&) = delete;
+
+    patch as_patch() const;
+
+    size_t instruction_count() const
+    {
+        return code_.size();
+    }
+
+    size_t register_count() const
+    {
+        return register_count_;
+    }
+
+    size_t state_bytes() const
+    {
+        return prototype_.size();
+    }
+
+private:
+    friend class patch_compiler;
+    friend struct patch_kernels;
+
+    struct frame;
+    struct instruction;
+
+    using handler = void (*)(const instruction&, frame&);
+
+    // Block registers, scalar slots and node states are indices and byte
+    // offsets fixed at compile time.
+    struct instruction
+    {
+        handler run_;
+        uint16_t dst_;
+        uint16_t a_;
+        uint16_t b_;
+        uint16_t scope_;
+        uint32_t state_;
+        uint32_t first_;
+        uint32_t count_;
+        uint32_t jump_;
+    };
+
+    struct operand
+    {
+        uint16_t index_;
+        bool scalar_;
+    };
+
+    enum class quiet_op : uint8_t
+    {
+        envelope,
+        volume,
+        min
+    };
+
+    // Node state a scope copies back from the prototype to restart.
+    struct state_range
+    {
+        uint32_t offset_;
+        uint32_t bytes_;
+    };
+
+    // Postfix expression for a subtree's quiet span.
+    struct quiet_term
+    {
+        quiet_op op_;
+        uint32_t arg_;
+    };
+
+    enum class note_op : uint8_t
+    {
+        base_freq,
+        ratio,
+        detune,
+        polynomial,
+        mix,
+        volume
+    };
+
+    // Per-note scalar, recomputed whenever the voice parameters change.
+    struct note_instruction
+    {
+        note_op op_;
+        uint16_t dst_;
+        uint32_t first_;
+        uint32_t count_;
+    };
+
+    static float evaluate(note_op op, float base_freq, const float* args, size_t count);
+
+    void render(const voice_parameters& params, std::byte* state, float* out, size_t frames) const;
+    void prepare(const voice_parameters& params, std::byte* state) const;
+    size_t quiet(const voice_parameters& params, std::byte* state, uint32_t first, uint32_t count) const;
+    void restart(std::byte* state, uint32_t first, uint32_t count) const;
+
+    static const patch_program& of(const void* state);
+
+    static float sample_hook(const voice_parameters& params, void* state);
+    static void process_block_hook(const voice_parameters& params, void* state, float* out, size_t frames);
+    static void prepare_hook(const voice_parameters& params, void* state);
+    static size_t quiet_hook(const voice_parameters& params, void* state);
+    static void reset_hook(void* state);
+    static void bind_hook(void* state, const void* program);
+
+    static void process_lanes_hook(const voice_parameters* voices, void* group, float* out, size_t frames);
+    static void reset_lane_hook(void* group, size_t lane);
+    static void prepare_lane_hook(const voice_parameters& params, void* group, size_t lane);
+    static size_t quiet_lane_hook(const voice_parameters* voices, void* group, size_t lane);
+    static void construct_lanes_hook(void* group);
+    static void bind_lanes_hook(void* group, const void* program);
+
+    std::vector<instruction> code_;
+    std::vector<operand> operands_;
+    std::vector<quiet_term> quiet_terms_;
+    std::vector<state_range> restarts_;
+    std::vector<note_instruction> note_code_;
+    std::vector<uint16_t> note_args_;
+
+    // A pointer to this program, the node states, then the scalars from
+    // scalars_offset_; reset copies it over a voice.
+    std::vector<std::byte> prototype_;
+    size_t scalars_offset_{0};
+    size_t slot_bytes_{0};
+    size_t lanes_{1};
+
+    uint16_t result_{0};
+    uint32_t root_quiet_first_{0};
+    uint32_t root_quiet_count_{0};
+    size_t register_count_{0};
+};
+
+}
@@ -1,7 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
 #include "patch.hpp"
+#include "simd.hpp"
 #include "voice_parameters.hpp"
+#include "global_constants.hpp"
+#include "dsp/node.hpp"
+#include "dsp/lanes.hpp"
+#include "dsp/shared.hpp"
 
 namespace lyrid
 {
@@ -9,31 +18,174 @@ namespace lyrid
 template<typename T>
 struct patch_wrapper
 {
-    static void construct(void* ptr)
-    {
-        new (ptr) T();
-    }
-
-    static void destruct(void* ptr)
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+        "voice states are reset by copying and dropped without destruction");
+    
+    // State of a voice before its first sample. Bindings to shared slots are
+    // relative, so they hold in every copy.
+    inline static const T prototype{};
+    
+    static void reset(void* ptr)
     {
-        static_cast<T*>(ptr)->~T();
+        std::memcpy(ptr, &prototype, sizeof(T));
     }
 
     static float sample(const voice_parameters& params, void* state_memory)
     {
         return static_cast<T*>(state_memory)->sample(params);
     }
+    
+    static void process_block(const voice_parameters& params, void* state_memory, float* out, size_t frames)
+    {
+        static_cast<T*>(state_memory)->process_block(params, out, frames);
+    }
+    
+    static void prepare(const voice_parameters& params, void* state_memory)
+    {
+        dsp::prepare(*static_cast<T*>(state_memory), params);
+    }
+    
+    static size_t quiet(const voice_parameters& params, void* state_memory)
+    {
+        return dsp::quiet_frames(*static_cast<T*>(state_memory), params);
+    }
+    
+    // Lane groups are built once per instrument, voices join them through
+    // reset_lane.
+    template<size_t Lanes>
+    static void construct_lanes(void* ptr)
+    {
+        static_assert(std::is_trivially_destructible_v<dsp::lane_batch<T, Lanes>>);
+        new (ptr) dsp::lane_batch<T, Lanes>();
+    }
+    
+    template<size_t Lanes>
+    static void reset_lane(void* ptr, size_t lane)
+    {
+        dsp::reset_lane(*static_cast<dsp::lane_batch<T, Lanes>*>(ptr), lane);
+    }
+    
+    template<size_t Lanes>
+    static void prepare_lane(const voice_parameters& params, void* ptr, size_t lane)
+    {
+        dsp::prepare_lane(*static_cast<dsp::lane_batch<T, Lanes>*>(ptr), lane, params);
+    }
+    
+    template<size_t Lanes>
+    [[gnu::always_inline]] static inline dsp::lane_parameters<Lanes> lane_params(const voice_parameters* voices)
+    {
+        dsp::lane_parameters<Lanes> params;
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            params.base_freq_[l] = voices[l].base_freq_;
+            params.voices_[l] = &voices[l];
+        }
+        return params;
+    }
+    
+    template<size_t Lanes>
+    static size_t quiet_lane(const voice_parameters* voices, void* ptr, size_t lane)
+    {
+        return dsp::quiet_frames(*static_cast<dsp::lane_batch<T, Lanes>*>(ptr), lane_params<Lanes>(voices), lane);
+    }
+    
+    template<size_t Lanes>
+    [[gnu::always_inline]] static inline void process_lanes(const voice_parameters* voices, void* state_memory, float* out, size_t frames)
+    {
+        dsp::lane_parameters<Lanes> params = lane_params<Lanes>(voices);
+        
+        auto* state = static_cast<dsp::lane_batch<T, Lanes>*>(state_memory);
+        constexpr size_t chunk = dsp::lane_block_frames<Lanes>;
+        
+        for (size_t offset = 0; offset < frames; offset += chunk)
+            state->process_block(params, out + offset * Lanes, std::min(chunk, frames - offset));
+    }
+    
+    static void process_lanes_4(const voice_parameters* voices, void* state_memory, float* out, size_t frames)
+    {
+        process_lanes<4>(voices, state_memory, out, frames);
+    }
+    
+    LYRID_TARGET("avx2,fma")
+    static void process_lanes_8(const voice_parameters* voices, void* state_memory, float* out, size_t frames)
+    {
+        process_lanes<8>(voices, state_memory, out, frames);
+    }
+    
+    LYRID_TARGET("avx512f")
+    static void process_lanes_16(const voice_parameters* voices, void* state_memory, float* out, size_t frames)
+    {
+        process_lanes<16>(voices, state_memory, out, frames);
+    }
+};
+
+// Voice states start on their own cache line, so neighbouring voices never
+// share one.
+constexpr size_t slot_size(size_t bytes)
+{
+    return (bytes + cache_line_size - 1) / cache_line_size * cache_line_size;
+}
+
+// Per-voice state of Patch as wrap() lays it out.
+template<typename Patch>
+struct footprint
+{
+    using voice = dsp::voice_type_t<Patch>;
+    
+    static constexpr size_t state_bytes = sizeof(voice);
+    static constexpr size_t slot_bytes = slot_size(sizeof(voice));
+    
+    // Share of one lane group's state per voice.
+    template<size_t Lanes>
+    static constexpr size_t lane_bytes = slot_size(sizeof(dsp::lane_batch<voice, Lanes>)) / Lanes;
+    
+    static_assert(alignof(voice) <= cache_line_size);
 };
 
+template<typename Patch, size_t Lanes>
+lane_kernel make_lane_kernel(lane_sampler s)
+{
+    return lane_kernel
+    {
+        Lanes,
+        s,
+        patch_wrapper<Patch>::template reset_lane<Lanes>,
+        patch_wrapper<Patch>::template prepare_lane<Lanes>,
+        patch_wrapper<Patch>::template quiet_lane<Lanes>,
+        patch_wrapper<Patch>::template construct_lanes<Lanes>,
+        slot_size(sizeof(dsp::lane_batch<Patch, Lanes>))
+    };
+}
+
+template<typename Patch>
+lane_kernel wrap_lanes()
+{
+    switch (native_lanes())
+    {
+        case 16:
+            return make_lane_kernel<Patch, 16>(patch_wrapper<Patch>::process_lanes_16);
+        case 8:
+            return make_lane_kernel<Patch, 8>(patch_wrapper<Patch>::process_lanes_8);
+        default:
+            return make_lane_kernel<Patch, 4>(patch_wrapper<Patch>::process_lanes_4);
+    }
+}
+
+// Repeated subtrees of Patch are evaluated once per voice, see dsp::dedup_t.
 template<typename Patch>
 auto wrap()
 {
+    using voice = dsp::voice_type_t<Patch>;
+    
     return patch
     {
-        patch_wrapper<Patch>::sample,
-        patch_wrapper<Patch>::construct,
-        patch_wrapper<Patch>::destruct,
-        sizeof(Patch)
+        patch_wrapper<voice>::sample,
+        patch_wrapper<voice>::process_block,
+        patch_wrapper<voice>::prepare,
+        patch_wrapper<voice>::quiet,
+        patch_wrapper<voice>::reset,
+        footprint<Patch>::slot_bytes,
+        wrap_lanes<voice>()
     };
 }
 
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "dsp/wave_generators.hpp"
+#include "dsp/wavetable.hpp"
+#include "dsp/base_freq.hpp"
+#include "dsp/envelope.hpp"
+#include "dsp/constant.hpp"
+#include "dsp/volume.hpp"
+#include "dsp/mix.hpp"
+#include "dsp/detune.hpp"
+#include "dsp/polynomial.hpp"
+#include "dsp/control.hpp"
+#include "dsp/unison.hpp"
+#include "dsp/filter.hpp"
+
+namespace lyrid
+{
+
+namespace patches
+{
+
+using namespace dsp;
+
+// Ticks every control_interval samples instead of running a sine per sample.
+using lfo = control<dsp::lfo<constant<7.0f>>>;
+using vibrato = modulated<base_freq, route<lfo, constant<5.0f>>>;
+
+using supersaw = volume
+<
+    mix
+    < 
+        saw<detune<vibrato, constant<-8.0f>>>, 
+        saw<detune<vibrato, constant<-5.0f>>>, 
+        saw<detune<vibrato, constant<-2.0f>>>, 
+        saw<vibrato>, 
+        saw<detune<vibrato, constant<1.0f>>>, 
+        saw<detune<vibrato, constant<3.0f>>>, 
+        saw<detune<vibrato, constant<7.0f>>>, 
+        saw<detune<vibrato, constant<9.0f>>>
+    >,
+    envelope_ar<constant<0.5f>, constant<5.0f>>
+>;
+
+// supersaw as one node, its copies spread evenly over 17 cents.
+using unison_supersaw = volume
+<
+    unison<8, saw, vibrato, constant<17.0f>>,
+    envelope_ar<constant<0.5f>, constant<5.0f>>
+>;
+
+using bl_unison_supersaw = volume
+<
+    unison<8, bl_saw, vibrato, constant<17.0f>>,
+    envelope_ar<constant<0.5f>, constant<5.0f>>
+>;
+
+using sine_pad = volume
+<
+    mix<sine<base_freq>, sine<detune<base_freq, constant<1200.0f>>>>,
+    envelope_ar<constant<1.0f>, constant<3.0f>>
+>;
+
+using square_lead = volume
+<
+    mix<square<vibrato>, triangle<detune<base_freq, constant<-1200.0f>>>>,
+    envelope<constant<0.0f>, constant<0.01f>, constant<0.0f>, constant<0.3f>, constant<0.6f>, constant<0.5f>>
+>;
+
+using bl_supersaw = volume
+<
+    mix
+    < 
+        bl_saw<detune<vibrato, constant<-8.0f>>>, 
+        bl_saw<detune<vibrato, constant<-5.0f>>>, 
+        bl_saw<detune<vibrato, constant<-2.0f>>>, 
+        bl_saw<vibrato>, 
+        bl_saw<detune<vibrato, constant<1.0f>>>, 
+        bl_saw<detune<vibrato, constant<3.0f>>>, 
+        bl_saw<detune<vibrato, constant<7.0f>>>, 
+        bl_saw<detune<vibrato, constant<9.0f>>>
+    >,
+    envelope_ar<constant<0.5f>, constant<5.0f>>
+>;
+
+using fast_sine_pad = volume
+<
+    mix<fast_sine<base_freq>, fast_sine<detune<base_freq, constant<1200.0f>>>>,
+    envelope_ar<constant<1.0f>, constant<3.0f>>
+>;
+
+using bl_square_lead = volume
+<
+    mix<bl_square<vibrato>, bl_triangle<detune<base_freq, constant<-1200.0f>>>>,
+    envelope<constant<0.0f>, constant<0.01f>, constant<0.0f>, constant<0.3f>, constant<0.6f>, constant<0.5f>>
+>;
+
+// Swells in after half a second; until then only the envelope runs.
+using delayed_pad = volume
+<
+    mix<sine<base_freq>, sine<detune<base_freq, constant<1200.0f>>>>,
+    envelope<constant<0.5f>, constant<1.0f>, constant<0.0f>, constant<0.0f>, constant<1.0f>, constant<3.0f>>
+>;
+
+// Key tracked cutoff fixed for the note: the filter computes its
+// coefficients once.
+using filter_pad = volume
+<
+    svf<mix<saw<base_freq>, saw<detune<base_freq, constant<7.0f>>>>, linear<base_freq, constant<0.0f>, constant<4.0f>>, constant<0.3f>>,
+    envelope_ar<constant<0.5f>, constant<3.0f>>
+>;
+
+// Ladder swept by its own envelope, so its coefficients follow at control rate.
+using filter_bass = volume
+<
+    ladder
+    <
+        mix<saw<base_freq>, square<detune<base_freq, constant<-1200.0f>>>>,
+        linear<envelope<constant<0.0f>, constant<0.005f>, constant<0.0f>, constant<0.4f>, constant<0.2f>, constant<0.3f>>, constant<200.0f>, constant<3000.0f>>,
+        constant<0.6f>
+    >,
+    envelope<constant<0.0f>, constant<0.005f>, constant<0.0f>, constant<0.3f>, constant<0.8f>, constant<0.3f>>
+>;
+
+using noise_breath = volume
+<
+    mix<pink_noise, saw<base_freq>>,
+    envelope_ar<constant<0.2f>, constant<1.0f>>
+>;
+
+}
+
+}
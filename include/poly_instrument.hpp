@@ -4,160 +4,612 @@
 #include <cstdint>
 #include <algorithm>
 #include <cmath>
-#include <numeric>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 #include "voice_parameters.hpp"
 #include "patch.hpp"
+#include "note_event.hpp"
+#include "ring_buffer.hpp"
+#include "voice_manager.hpp"
+#include "worker_pool.hpp"
+#include "realtime.hpp"
+#include "global_constants.hpp"
 #include "dsp/math.hpp"
+#include "dsp/node.hpp"
 
 namespace lyrid
 {
+
+enum class render_mode { scalar, lanes };
+
+// What happens to held notes when a new patch is published: they keep
+// playing the old one until released, or restart on the new one while their
+// old voices release.
+enum class handoff { finish, crossfade };
     
 class poly_instrument
 {
 public:
-    poly_instrument(size_t max_voices, patch p)
-        : max_voices_(max_voices), p_(p)
+    poly_instrument(size_t max_voices, patch p, render_mode mode = render_mode::scalar)
+        : max_voices_(max_voices), mode_(mode)
     {
-        init();
+        init(p);
     }
     
+    poly_instrument(const poly_instrument&) = delete;
+    poly_instrument& operator=(const poly_instrument&) = delete;
+    
     float sample()
     {
-        float sum = 0.0f;
+        float out;
+        render(&out, 1);
+        return out;
+    }
     
-        const auto& read_order = order_[read_order_idx_];
-        auto& write_order = order_[write_order_idx_];
-        size_t write_idx = 0;
+    void render(float* out, size_t frames)
+    {
+        adopt_banks();
+        drain_events();
         
-        for (size_t i = 0; i < audible_count_; ++i)
+        while (frames > 0)
         {
-            size_t slot_idx = read_order[i];
-            voice_parameters& params = params_[slot_idx];
-            
-            float sample = p_.sampler_(params_[slot_idx], get_slot_state_raw_ptr(slot_idx));
-            sum += (sample * global_scaling);
-            params.smoothed_power_ = alpha * sample * sample + (1 - alpha) * params.smoothed_power_;
-            
-            if (params.state_ == voice_state::active || params.smoothed_power_ > inaudible_amplitude)
+            size_t block = apply_due_events(std::min(frames, max_block_size));
+            render_block(out, block);
+            out += block;
+            frames -= block;
+            time_.store(time_.load(std::memory_order_relaxed) + block, std::memory_order_relaxed);
+        }
+        
+        epoch_.store(epoch_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    
+    // Control thread side. Events are applied by render() at their exact frame.
+    bool post(const note_event& ev)
+    {
+        return events_.push(ev);
+    }
+    
+    bool note_on(uint64_t id, float freq, uint64_t time = 0)
+    {
+        return post(note_event{event_type::note_on, time, id, freq});
+    }
+    
+    bool note_off(uint64_t id, uint64_t time = 0)
+    {
+        return post(note_event{event_type::note_off, time, id, 0.0f});
+    }
+    
+    bool set_freq(uint64_t id, float freq, uint64_t time = 0)
+    {
+        return post(note_event{event_type::set_freq, time, id, freq});
+    }
+    
+    // Control thread side. Voice state for p is built here; the renderer
+    // picks it up at its next render() and starts new notes on it, without
+    // locking or allocating. Fails while max_banks patches are still playing.
+    bool publish(patch p, handoff mode = handoff::finish)
+    {
+        collect();
+        
+        owned_.push_back(std::make_unique<bank>(p, mode_, max_voices_));
+        owned_.back()->handoff_ = mode;
+        
+        if (!published_.push(owned_.back().get()))
+        {
+            owned_.pop_back();
+            return false;
+        }
+        return true;
+    }
+    
+    // Control thread side. Frees patches the renderer has retired, once the
+    // render() call that let go of them has returned. Called by publish().
+    void collect()
+    {
+        bank* b;
+        while (retired_.pop(b))
+            retiring_.push_back(b);
+        
+        uint64_t epoch = epoch_.load(std::memory_order_acquire);
+        std::erase_if(retiring_, 
+            [&](bank* r)
             {
-                if (write_idx != 0)
-                {
-                    size_t prev_slot_idx = write_order[write_idx - 1];
-                    float prev_score = slot_score(prev_slot_idx);
+                if (r->retired_at_ >= epoch)
+                    return false;
                 
-                    if (prev_score < slot_score(slot_idx))
+                std::erase_if(owned_, 
+                    [r](const std::unique_ptr<bank>& o)
                     {
-                        write_order[write_idx - 1] = slot_idx;
-                        write_order[write_idx] = prev_slot_idx;
-                    }
-                    else
-                        write_order[write_idx] = slot_idx;
-                }
-                else
-                    write_order[write_idx] = slot_idx;
-                write_idx++;
-            }
-            else
-            {
-                free_[free_count_++] = slot_idx;
-                params.state_ = voice_state::free;
-                p_.dstr_(get_slot_state_raw_ptr(slot_idx));
-            }
-        }
-
-        audible_count_ = write_idx;
-        std::swap(read_order_idx_, write_order_idx_);
-        
-        return sum;
+                        return o.get() == r;
+                    });
+                return true;
+            });
+    }
+    
+    // Audio thread side, between renders.
+    size_t audible_voices() const
+    {
+        return voices_.audible().size();
+    }
+    
+    size_t max_voices() const
+    {
+        return max_voices_;
+    }
+    
+    // Opt-in multi-core rendering; the pool may be shared by several instruments
+    // rendered from the same thread. Set before rendering starts.
+    void set_worker_pool(worker_pool* pool)
+    {
+        pool_ = pool;
+    }
+    
+    // Set before rendering starts.
+    void set_steal_policy(steal_policy policy)
+    {
+        voices_.set_policy(policy);
+    }
+    
+    // Frame the renderer will produce next.
+    uint64_t time() const
+    {
+        return time_.load(std::memory_order_relaxed);
     }
 
+    // Renderer thread side, applied immediately. A note id that is still
+    // held is released first, so a retrigger never orphans a voice.
     size_t on(uint64_t id, float freq)
     {
-        size_t idx = allocate_voice();
-
+        off(id);
+        
+        size_t idx = voices_.allocate(id);
+        if (idx == voice_manager::npos)
+            return idx;
+        
         auto& params = params_[idx];
+        if (params.state_ != voice_state::free)
+            --bank_of_[idx]->voices_;
+        
+        bank_of_[idx] = current_;
+        ++current_->voices_;
+        
         params.base_freq_ = freq;
         params.state_ = voice_state::active;
-        params.id_ = id;
-        p_.cnstr_(get_slot_state_raw_ptr(idx));
+        
+        if (mode_ == render_mode::lanes)
+            current_->p_.lanes_.reset_(current_->group_state(idx / lanes_), idx % lanes_);
+        else
+            current_->p_.reset_(current_->slot_state(idx));
+        
+        prepare_voice(idx);
         return idx;
     }
 
     size_t off(uint64_t id)
     {
-        auto& order = order_[read_order_idx_];
+        size_t idx = voices_.find(id);
+        if (idx != voice_manager::npos && params_[idx].state_ == voice_state::active)
+            params_[idx].state_ = voice_state::releasing;
+        return idx;
+    }
+    
+    // Patches one instrument can play at once, the current one included.
+    constexpr static size_t max_banks = 8;
+    
+private:
+    constexpr static size_t event_capacity = 1024;
+    
+    // Unit of state memory; patch state sizes are whole multiples of it.
+    struct alignas(cache_line_size) cache_line
+    {
+        unsigned char bytes_[cache_line_size];
+    };
+    
+    // A published patch with state and output for every voice that may play
+    // it. Built and freed on the control thread; the renderer only counts
+    // the voices using it.
+    struct bank
+    {
+        bank(patch p, render_mode mode, size_t max_voices)
+            : p_(p)
+        {
+            if (mode == render_mode::lanes)
+            {
+                size_t groups = max_voices / p_.lanes_.lanes_;
+                state_memory_.resize(p_.lanes_.state_size_ * groups / cache_line_size);
+                group_pending_.resize(groups);
+                
+                for (size_t g = 0; g < groups; ++g)
+                {
+                    p_.lanes_.cnstr_(group_state(g));
+                    if (p_.lanes_.bind_ != nullptr)
+                        p_.lanes_.bind_(group_state(g), p_.data_);
+                }
+            }
+            else
+            {
+                state_memory_.resize(p_.state_size_ * max_voices / cache_line_size);
+                
+                if (p_.bind_ != nullptr)
+                {
+                    for (size_t slot_idx = 0; slot_idx < max_voices; ++slot_idx)
+                        p_.bind_(slot_state(slot_idx), p_.data_);
+                }
+            }
+            
+            voice_out_.resize(max_voices * max_block_size);
+            job_cost_.resize(max_voices);
+            
+            prefault(state_memory_.data(), state_memory_.size() * sizeof(cache_line));
+            prefault(voice_out_.data(), voice_out_.size() * sizeof(float));
+        }
+        
+        void* slot_state(size_t slot_idx)
+        {
+            return static_cast<void*>(state_memory_.data()->bytes_ + slot_idx * p_.state_size_);
+        }
         
-        for (size_t i = 0; i < audible_count_; ++i)
+        void* group_state(size_t group_idx)
         {
-            size_t idx = order[i];
-            auto& params = params_[idx];
-            if (params.id_ == id)
+            return static_cast<void*>(state_memory_.data()->bytes_ + group_idx * p_.lanes_.state_size_);
+        }
+        
+        patch p_;
+        handoff handoff_{handoff::finish};
+        std::vector<cache_line> state_memory_;
+        std::vector<float> voice_out_;
+        std::vector<uint8_t> group_pending_;
+        std::vector<float> job_cost_;
+        size_t voices_{0};
+        uint64_t retired_at_{0};
+    };
+    
+    // One voice slot, or one lane group in lane mode, of a bank.
+    struct job
+    {
+        bank* bank_;
+        size_t idx_;
+    };
+    
+    struct held_note
+    {
+        uint64_t id_;
+        float freq_;
+    };
+    
+    struct pending_event
+    {
+        note_event ev_;
+        uint64_t seq_;
+        
+        bool operator>(const pending_event& other) const
+        {
+            return ev_.time_ != other.ev_.time_ ? ev_.time_ > other.ev_.time_ : seq_ > other.seq_;
+        }
+    };
+    
+    // Switches new notes to the patches published since the last call.
+    void adopt_banks()
+    {
+        bank* b;
+        while (bank_count_ < max_banks && published_.pop(b))
+        {
+            banks_[bank_count_++] = b;
+            current_ = b;
+            if (b->handoff_ == handoff::crossfade)
+                restart_held();
+        }
+    }
+    
+    // Held notes of older patches start again on the current one; on()
+    // releases their old voices.
+    void restart_held()
+    {
+        size_t count = 0;
+        for (size_t slot_idx : voices_.audible())
+        {
+            if (params_[slot_idx].state_ == voice_state::active && bank_of_[slot_idx] != current_)
+                held_[count++] = held_note{voices_.id(slot_idx), params_[slot_idx].base_freq_};
+        }
+        
+        for (size_t i = 0; i < count; ++i)
+            on(held_[i].id_, held_[i].freq_);
+    }
+    
+    // Older patches no voice plays any more go back to the control thread.
+    void retire_banks()
+    {
+        for (size_t i = 0; i < bank_count_;)
+        {
+            bank* b = banks_[i];
+            if (b != current_ && b->voices_ == 0)
             {
-                params.state_ = voice_state::releasing;
-                return idx;
+                b->retired_at_ = epoch_.load(std::memory_order_relaxed);
+                if (retired_.push(b))
+                {
+                    banks_[i] = banks_[--bank_count_];
+                    continue;
+                }
             }
+            ++i;
         }
-        return -1;
     }
     
-private:
-    size_t allocate_voice()
+    void drain_events()
     {
-        size_t result;
-        auto& order = order_[read_order_idx_];
-        if (free_count_ > 0)
+        note_event ev;
+        while (pending_.size() < event_capacity && events_.pop(ev))
         {
-            result = free_[--free_count_];
-            order[audible_count_++] = result;
+            pending_.push_back(pending_event{ev, event_seq_++});
+            std::push_heap(pending_.begin(), pending_.end(), std::greater<>{});
         }
+    }
+    
+    size_t apply_due_events(size_t frames)
+    {
+        uint64_t now = time_.load(std::memory_order_relaxed);
+        
+        while (!pending_.empty())
+        {
+            const note_event& ev = pending_.front().ev_;
+            if (ev.time_ > now)
+                return std::min<uint64_t>(frames, ev.time_ - now);
+            
+            apply_event(ev);
+            std::pop_heap(pending_.begin(), pending_.end(), std::greater<>{});
+            pending_.pop_back();
+        }
+        return frames;
+    }
+    
+    void apply_event(const note_event& ev)
+    {
+        switch (ev.type_)
+        {
+            case event_type::note_on:
+                on(ev.id_, ev.value_);
+                break;
+            case event_type::note_off:
+                off(ev.id_);
+                break;
+            case event_type::set_freq:
+            {
+                size_t idx = voices_.find(ev.id_);
+                if (idx != voice_manager::npos)
+                {
+                    params_[idx].base_freq_ = ev.value_;
+                    prepare_voice(idx);
+                }
+                break;
+            }
+        }
+    }
+    
+    // Re-evaluates the per-note constant parts of a voice's patch.
+    void prepare_voice(size_t idx)
+    {
+        bank& b = *bank_of_[idx];
+        if (mode_ == render_mode::lanes)
+            b.p_.lanes_.prepare_(params_[idx], b.group_state(idx / lanes_), idx % lanes_);
         else
-            result = order[max_voices_ - 1];
-        return result;
+            b.p_.prepare_(params_[idx], b.slot_state(idx));
     }
     
-    void init()
+    void render_block(float* out, size_t frames)
     {
-        state_memory_.resize(p_.state_size_ * max_voices_);
-        params_.resize(max_voices_);
+        std::fill_n(out, frames, 0.0f);
         
-        read_order_idx_ = 0;
-        write_order_idx_ = 1;
-        audible_count_ = 0;
-        free_count_ = max_voices_;
+        collect_jobs(frames);
+        render_jobs(frames);
+    
+        size_t stride = mode_ == render_mode::lanes ? lanes_ : 1;
+        float keep = std::pow(1.0f - alpha, static_cast<float>(frames));
         
-        order_[0].resize(max_voices_);
-        order_[1].resize(max_voices_);
-        free_.resize(max_voices_);
+        // Voices are summed in a fixed order whoever rendered them, so parallel
+        // and single-threaded output are bit-identical. Power is smoothed per
+        // block from the block's mean square.
+        voices_.update(
+            [&](size_t slot_idx)
+            {
+                voice_parameters& params = params_[slot_idx];
+                float energy = 0.0f;
+                
+                if (!silent_[slot_idx])
+                {
+                    const float* voice_src = bank_of_[slot_idx]->voice_out_.data() + (slot_idx / stride) * stride * max_block_size + slot_idx % stride;
+                    
+                    for (size_t j = 0; j < frames; ++j)
+                    {
+                        float sample = voice_src[j * stride];
+                        out[j] += sample * global_scaling;
+                        energy += sample * sample;
+                    }
+                }
+                
+                params.smoothed_power_ = keep * params.smoothed_power_ + (1 - keep) * energy / frames;
+                
+                if (params.state_ == voice_state::active)
+                    return true;
+                
+                if (params.smoothed_power_ > inaudible_amplitude && voice_quiet(slot_idx) != dsp::always_quiet)
+                    return true;
+                
+                params.state_ = voice_state::free;
+                --bank_of_[slot_idx]->voices_;
+                return false;
+            });
         
-        std::iota(free_.begin(), free_.end(), 0);
+        retire_banks();
     }
-
-    float slot_score(size_t slot_idx) const
+    
+    // Frames the voice in a slot reports it will stay silent for.
+    size_t voice_quiet(size_t slot_idx)
     {
-        return static_cast<float>(params_[slot_idx].state_ == voice_state::active) * 1000.0 + params_[slot_idx].smoothed_power_;
+        bank& b = *bank_of_[slot_idx];
+        if (mode_ == render_mode::lanes)
+        {
+            size_t group = slot_idx / lanes_;
+            return b.p_.lanes_.quiet_(&params_[group * lanes_], b.group_state(group), slot_idx % lanes_);
+        }
+        
+        return b.p_.quiet_(params_[slot_idx], b.slot_state(slot_idx));
     }
-
-    void* get_slot_state_raw_ptr(size_t slot_idx)
+    
+    // A job is one voice slot, or one lane group in lane mode. Voices silent
+    // for the whole block are still rendered to advance their state, but
+    // left out of the mix.
+    void collect_jobs(size_t frames)
+    {
+        const auto& audible = voices_.audible();
+        job_count_ = 0;
+        
+        for (size_t slot_idx : audible)
+            silent_[slot_idx] = voice_quiet(slot_idx) >= frames;
+        
+        if (mode_ == render_mode::scalar)
+        {
+            for (size_t slot_idx : audible)
+                jobs_[job_count_++] = job{bank_of_[slot_idx], slot_idx};
+            return;
+        }
+        
+        for (size_t slot_idx : audible)
+            bank_of_[slot_idx]->group_pending_[slot_idx / lanes_] = 1;
+        
+        for (size_t i = 0; i < bank_count_; ++i)
+        {
+            bank* b = banks_[i];
+            for (size_t g = 0; g < b->group_pending_.size(); ++g)
+            {
+                if (b->group_pending_[g])
+                {
+                    b->group_pending_[g] = 0;
+                    jobs_[job_count_++] = job{b, g};
+                }
+            }
+        }
+    }
+    
+    void render_jobs(size_t frames)
+    {
+        job_frames_ = frames;
+        
+        if (use_pool(frames))
+        {
+            std::sort(jobs_.begin(), jobs_.begin() + job_count_, 
+                [](const job& a, const job& b)
+                {
+                    return a.bank_->job_cost_[a.idx_] > b.bank_->job_cost_[b.idx_];
+                });
+            pool_->run(render_job_task, this, job_count_);
+        }
+        else
+        {
+            for (size_t i = 0; i < job_count_; ++i)
+                render_job(jobs_[i]);
+        }
+    }
+    
+    static void render_job_task(void* ctx, size_t i)
     {
-        return static_cast<void*>(state_memory_.data() + slot_idx * p_.state_size_);
+        auto* self = static_cast<poly_instrument*>(ctx);
+        self->render_job(self->jobs_[i]);
+    }
+    
+    void render_job(const job& j)
+    {
+        auto start = pool_ != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        bank& b = *j.bank_;
+        
+        if (mode_ == render_mode::lanes)
+            b.p_.lanes_.sampler_(&params_[j.idx_ * lanes_], b.group_state(j.idx_), b.voice_out_.data() + j.idx_ * lanes_ * max_block_size, job_frames_);
+        else
+            b.p_.block_sampler_(params_[j.idx_], b.slot_state(j.idx_), b.voice_out_.data() + j.idx_ * max_block_size, job_frames_);
+        
+        if (pool_ != nullptr)
+        {
+            std::chrono::duration<float, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            float& cost = b.job_cost_[j.idx_];
+            cost += cost_smoothing * (elapsed.count() / job_frames_ - cost);
+        }
+    }
+    
+    // Fans out only when the estimated work is a real share of the block's
+    // deadline; below that the hand-off costs more than it saves.
+    bool use_pool(size_t frames) const
+    {
+        if (pool_ == nullptr || job_count_ < parallel_min_jobs)
+            return false;
+        
+        float load_ns = 0.0f;
+        for (size_t i = 0; i < job_count_; ++i)
+            load_ns += jobs_[i].bank_->job_cost_[jobs_[i].idx_] * frames;
+        
+        float deadline_ns = frames * 1.0e9f * rates().sample_period_;
+        return load_ns > parallel_min_load * deadline_ns;
+    }
+    
+    void init(patch p)
+    {
+        lanes_ = mode_ == render_mode::lanes ? p.lanes_.lanes_ : 1;
+        max_voices_ = (max_voices_ + lanes_ - 1) / lanes_ * lanes_;
+        
+        owned_.push_back(std::make_unique<bank>(p, mode_, max_voices_));
+        current_ = owned_.back().get();
+        banks_[bank_count_++] = current_;
+        
+        params_.resize(max_voices_);
+        bank_of_.assign(max_voices_, current_);
+        silent_.resize(max_voices_);
+        held_.resize(max_voices_);
+        jobs_.resize(max_voices_ * max_banks);
+        
+        voices_.init(max_voices_, params_.data());
+        
+        pending_.reserve(event_capacity);
     }
     
     size_t max_voices_;
-    patch p_;
-    
-    std::vector<size_t> order_[2];
-    size_t read_order_idx_;
-    size_t write_order_idx_;
-    size_t audible_count_;
-    size_t free_count_;
-    std::vector<size_t> free_;
-    std::vector<unsigned char> state_memory_;
+    render_mode mode_;
+    size_t lanes_{1};
+    
+    voice_manager voices_;
     std::vector<voice_parameters> params_;
+    std::vector<bank*> bank_of_;
+    std::vector<uint8_t> silent_;
+    std::vector<held_note> held_;
+    
+    // Renderer side: the patch new notes start on and every patch still playing.
+    bank* current_{nullptr};
+    std::array<bank*, max_banks> banks_{};
+    size_t bank_count_{0};
+    
+    // Control side ownership and the hand-over in both directions.
+    std::vector<std::unique_ptr<bank>> owned_;
+    std::vector<bank*> retiring_;
+    spsc_ring<bank*, max_banks> published_;
+    spsc_ring<bank*, max_banks> retired_;
+    std::atomic<uint64_t> epoch_{0};
+    
+    worker_pool* pool_{nullptr};
+    std::vector<job> jobs_;
+    size_t job_count_{0};
+    size_t job_frames_{0};
+    
+    spsc_ring<note_event, event_capacity> events_;
+    std::vector<pending_event> pending_;
+    uint64_t event_seq_{0};
+    std::atomic<uint64_t> time_{0};
     
     constexpr static float inaudible_amplitude = 1.0e-7;
     constexpr static float alpha = 0.01f;
     constexpr static float global_scaling = 0.2f;
+    constexpr static size_t parallel_min_jobs = 4;
+    constexpr static float parallel_min_load = 0.25f;
+    constexpr static float cost_smoothing = 0.1f;
 };
 
 }
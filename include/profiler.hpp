@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "realtime.hpp"
+#include "ring_buffer.hpp"
+
+namespace lyrid
+{
+
+class engine;
+
+enum class profile_format { text, json };
+
+// Callback load histogram: buckets of 5% of the deadline, the last one
+// collecting everything from twice the deadline up.
+constexpr size_t load_buckets = 41;
+constexpr double load_bucket_width = 0.05;
+
+// Totals since the profiler started or was last reset. Load is render time
+// over the time the callback's frames play for; above 1 is a missed deadline.
+struct profile_snapshot
+{
+    uint64_t callbacks_{0};
+    uint64_t frames_{0};
+    uint64_t deadline_misses_{0};
+    uint64_t dropped_{0};
+    double mean_load_{0.0};
+    double max_load_{0.0};
+    double worst_us_{0.0};
+    size_t audible_voices_{0};
+    size_t free_voices_{0};
+    size_t peak_voices_{0};
+    std::array<uint64_t, load_buckets> load_histogram_{};
+};
+
+// Callback instrumentation. The audio thread brackets each callback with
+// begin() and end(), which read the cycle counter and push one record into
+// a wait-free ring; a drain thread folds the records into totals every
+// interval and, given a stream, writes them out.
+class profiler
+{
+public:
+    explicit profiler(engine& eng, std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~profiler();
+
+    profiler(const profiler&) = delete;
+    profiler& operator=(const profiler&) = delete;
+
+    // Periodic report of the totals, nullptr to stop.
+    void set_dump(std::ostream* out, profile_format format = profile_format::text);
+
+    // Audio thread.
+    uint64_t begin() const
+    {
+        return cycle_count();
+    }
+
+    void end(uint64_t start, size_t frames);
+
+    // Any thread but the audio thread.
+    profile_snapshot snapshot();
+    void reset();
+
+    static std::string to_text(const profile_snapshot& s);
+    static std::string to_json(const profile_snapshot& s);
+
+private:
+    // One callback as the audio thread saw it.
+    struct record
+    {
+        uint64_t cycles_;
+        uint32_t frames_;
+        uint32_t audible_voices_;
+        uint32_t free_voices_;
+    };
+
+    void drain_loop(std::chrono::milliseconds interval);
+    void drain();
+
+    engine& engine_;
+    double cycles_per_second_;
+
+    spsc_ring<record, 4096> records_;
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_{false};
+    profile_snapshot totals_;
+    double load_sum_{0.0};
+    std::ostream* dump_{nullptr};
+    profile_format format_{profile_format::text};
+
+    std::thread thread_;
+};
+
+}
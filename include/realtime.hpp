@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace lyrid
+{
+
+// Stack the render threads touch up front, deeper than any patch's block
+// buffers reach.
+constexpr size_t prefault_stack_bytes = 256 * 1024;
+
+// What set_realtime_priority got for the calling thread.
+enum class thread_priority
+{
+    realtime,
+    limited,
+    niced,
+    normal
+};
+
+// Best effort: raises the calling thread to SCHED_FIFO at priority. Without
+// CAP_SYS_NICE it settles, as rtkit would, for what the process limits
+// allow: SCHED_FIFO at RLIMIT_RTPRIO (limited), else a negative nice value
+// within RLIMIT_NICE (niced), else nothing (normal).
+thread_priority set_realtime_priority(int priority);
+
+// Best effort: locks the process's current and future pages in memory, so
+// rendering never waits on a page fault. Needs RLIMIT_MEMLOCK or privileges.
+bool lock_memory();
+
+// Flushes denormal results and operands to zero on the calling thread.
+// Decaying tails otherwise slow every operation on them by orders of magnitude.
+void disable_denormals();
+
+// Touches prefault_stack_bytes of the calling thread's stack, so its first
+// deep render does not fault pages in.
+void prefault_stack();
+
+// Writes to every page of a buffer, so none faults in on the render thread
+// even when lock_memory() was refused.
+void prefault(void* memory, size_t bytes);
+
+// Everything a thread that renders audio sets up before its first block.
+// The first thread denied its priority says so on stderr, with the limit
+// to raise.
+void prepare_render_thread(int priority);
+
+// Cheapest monotonic tick the platform has: the time stamp counter on x86,
+// the virtual counter on ARM, nanoseconds elsewhere. Its rate has to be
+// measured, see profiler.
+inline uint64_t cycle_count()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+#include "global_constants.hpp"
+
+namespace lyrid
+{
+
+// Wait-free single producer, single consumer ring.
+template<typename T, size_t Capacity>
+class spsc_ring
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    
+public:
+    bool push(const T& value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ == Capacity)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ == Capacity)
+                return false;
+        }
+        
+        items_[head & mask] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    bool pop(T& value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_)
+                return false;
+        }
+        
+        value = items_[tail & mask];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    
+private:
+    static constexpr size_t mask = Capacity - 1;
+    
+    alignas(cache_line_size) std::atomic<size_t> head_{0};
+    size_t tail_cache_{0};
+    alignas(cache_line_size) std::atomic<size_t> tail_{0};
+    size_t head_cache_{0};
+    alignas(cache_line_size) std::array<T, Capacity> items_;
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+
+namespace lyrid
+{
+
+// Built with LYRID_RT_CHECK, a thread inside an rt_scope may not allocate,
+// free, take a mutex, wait on a condition variable or make a blocking
+// system call: each such call is counted and the first few are reported to
+// stderr with a stack trace. Without it the scopes compile to nothing.
+#ifdef LYRID_RT_CHECK
+void rt_enter();
+void rt_leave();
+size_t rt_violations();
+#else
+inline void rt_enter()
+{
+}
+
+inline void rt_leave()
+{
+}
+
+inline size_t rt_violations()
+{
+    return 0;
+}
+#endif
+
+// Marks the calling thread as real-time while alive. Scopes nest.
+class rt_scope
+{
+public:
+    rt_scope()
+    {
+        rt_enter();
+    }
+
+    ~rt_scope()
+    {
+        rt_leave();
+    }
+
+    rt_scope(const rt_scope&) = delete;
+    rt_scope& operator=(const rt_scope&) = delete;
+};
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "note_event.hpp"
+
+namespace lyrid
+{
+
+// Seconds rendered after a score's last event when it does not say, for
+// release tails.
+constexpr double score_tail_seconds = 2.0;
+
+// Note events in time order on a timeline starting at frame 0, at the
+// sample rate current when the score was read, and the frames to render.
+struct score
+{
+    std::vector<note_event> events_;
+    uint64_t frames_{0};
+};
+
+// Text scores, one event per line, times in seconds, # to end of line is a
+// comment:
+//
+//     0.0 on 1 220        note 1 starts at 220 Hz
+//     0.5 freq 1 247      and glides to 247 Hz
+//     1.0 off 1
+//     3.0 end             optional, the length of the render
+score parse_score(const std::string& text);
+
+// Standard MIDI Files, formats 0 and 1. Notes follow the tempo map, each
+// channel and key pair is one note id, and everything but notes and tempo
+// changes is skipped.
+score parse_midi(std::span<const uint8_t> data);
+
+// Either of the above, told apart by the MIDI header.
+score load_score(const std::string& path);
+
+}
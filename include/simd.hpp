@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LYRID_X86_DISPATCH 1
+#define LYRID_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LYRID_TARGET(isa)
+#endif
+
+namespace lyrid
+{
+
+// Widest voice batch the running CPU handles in one vector register of floats.
+inline size_t native_lanes()
+{
+#ifdef LYRID_X86_DISPATCH
+    if (__builtin_cpu_supports("avx512f"))
+        return 16;
+    if (__builtin_cpu_supports("avx2"))
+        return 8;
+#endif
+    return 4;
+}
+
+}
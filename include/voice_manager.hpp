@@ -0,0 +1,243 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
+#include <numeric>
+
+#include "voice_parameters.hpp"
+
+namespace lyrid
+{
+
+// Which sounding voice gives way when a note arrives and no slot is free.
+// Releasing voices always go before held ones; none drops the new note.
+enum class steal_policy { quietest, oldest, none };
+
+// Slot bookkeeping for poly_instrument: which slots sound and in what order,
+// which are free, the note id of each, and who to steal. Lookups go through
+// a flat open-addressing map. Steal candidates come from a heap built on
+// first use after each block, from the voice states that block left, so
+// nothing here scans all voices per event.
+class voice_manager
+{
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    void init(size_t max_voices, const voice_parameters* params)
+    {
+        params_ = params;
+
+        audible_.clear();
+        audible_.reserve(max_voices);
+        free_.resize(max_voices);
+        std::iota(free_.begin(), free_.end(), 0);
+        ids_.assign(max_voices, 0);
+        started_.assign(max_voices, 0);
+        heap_.reserve(max_voices);
+        heap_valid_ = false;
+
+        size_t capacity = std::bit_ceil(std::max<size_t>(16, max_voices * 2));
+        map_.assign(capacity, map_entry{0, empty});
+        map_shift_ = 64 - std::countr_zero(capacity);
+    }
+
+    void set_policy(steal_policy policy)
+    {
+        policy_ = policy;
+        heap_valid_ = false;
+    }
+
+    // Sounding slots in summing order.
+    const std::vector<size_t>& audible() const
+    {
+        return audible_;
+    }
+
+    // Note id a sounding slot plays.
+    uint64_t id(size_t slot) const
+    {
+        return ids_[slot];
+    }
+
+    size_t find(uint64_t id) const
+    {
+        for (size_t pos = home(id);; pos = next(pos))
+        {
+            const map_entry& e = map_[pos];
+            if (e.slot_ == empty)
+                return npos;
+            if (e.id_ == id)
+                return e.slot_;
+        }
+    }
+
+    // Slot for a new note; a stolen slot still holds its previous voice.
+    // Returns npos when full and the policy is none.
+    size_t allocate(uint64_t id)
+    {
+        size_t slot;
+
+        if (!free_.empty())
+        {
+            slot = free_.back();
+            free_.pop_back();
+            audible_.push_back(slot);
+        }
+        else
+        {
+            slot = steal();
+            if (slot == npos)
+                return npos;
+            erase(ids_[slot], slot);
+        }
+
+        insert(id, slot);
+        ids_[slot] = id;
+        started_[slot] = ++note_count_;
+        return slot;
+    }
+
+    // Walks the audible slots in order, keeping those for which keep(slot)
+    // returns true and freeing the rest. Order is stable.
+    template<typename Keep>
+    void update(Keep&& keep)
+    {
+        size_t write_idx = 0;
+
+        for (size_t slot : audible_)
+        {
+            if (keep(slot))
+                audible_[write_idx++] = slot;
+            else
+            {
+                erase(ids_[slot], slot);
+                free_.push_back(slot);
+            }
+        }
+
+        audible_.resize(write_idx);
+        heap_valid_ = false;
+    }
+
+private:
+    static constexpr uint32_t empty = uint32_t(-1);
+
+    struct map_entry
+    {
+        uint64_t id_;
+        uint32_t slot_;
+    };
+
+    size_t home(uint64_t id) const
+    {
+        return (id * 0x9E3779B97F4A7C15ull) >> map_shift_;
+    }
+
+    size_t next(size_t pos) const
+    {
+        return (pos + 1) & (map_.size() - 1);
+    }
+
+    // A retriggered id maps to its newest slot.
+    void insert(uint64_t id, size_t slot)
+    {
+        size_t pos = home(id);
+        while (map_[pos].slot_ != empty && map_[pos].id_ != id)
+            pos = next(pos);
+        map_[pos] = map_entry{id, static_cast<uint32_t>(slot)};
+    }
+
+    // Removes id only while it still points at slot. Backward shift keeps
+    // probe chains intact without tombstones.
+    void erase(uint64_t id, size_t slot)
+    {
+        size_t pos = home(id);
+        for (;; pos = next(pos))
+        {
+            if (map_[pos].slot_ == empty)
+                return;
+            if (map_[pos].id_ == id)
+                break;
+        }
+
+        if (map_[pos].slot_ != slot)
+            return;
+
+        size_t hole = pos;
+        for (size_t cur = next(hole); map_[cur].slot_ != empty; cur = next(cur))
+        {
+            size_t want = home(map_[cur].id_);
+            if (((cur - want) & (map_.size() - 1)) >= ((cur - hole) & (map_.size() - 1)))
+            {
+                map_[hole] = map_[cur];
+                hole = cur;
+            }
+        }
+        map_[hole].slot_ = empty;
+    }
+
+    // Releasing before held, then by policy.
+    bool steal_before(size_t a, size_t b) const
+    {
+        bool held_a = params_[a].state_ == voice_state::active;
+        bool held_b = params_[b].state_ == voice_state::active;
+        if (held_a != held_b)
+            return held_b;
+        
+        if (policy_ == steal_policy::oldest)
+            return started_[a] < started_[b];
+        return params_[a].smoothed_power_ < params_[b].smoothed_power_;
+    }
+
+    size_t steal()
+    {
+        if (policy_ == steal_policy::none)
+            return npos;
+
+        if (!heap_valid_)
+        {
+            heap_.assign(audible_.begin(), audible_.end());
+            std::make_heap(heap_.begin(), heap_.end(), steal_order{this});
+            heap_valid_ = true;
+        }
+
+        // Every sounding voice started within this batch of events.
+        if (heap_.empty())
+            return audible_.front();
+
+        std::pop_heap(heap_.begin(), heap_.end(), steal_order{this});
+        size_t slot = heap_.back();
+        heap_.pop_back();
+        return slot;
+    }
+
+    // Heap top is the first voice to steal.
+    struct steal_order
+    {
+        bool operator()(size_t a, size_t b) const
+        {
+            return self_->steal_before(b, a);
+        }
+
+        const voice_manager* self_;
+    };
+
+    const voice_parameters* params_{nullptr};
+    steal_policy policy_{steal_policy::quietest};
+
+    std::vector<size_t> audible_;
+    std::vector<size_t> free_;
+    std::vector<uint64_t> ids_;
+    std::vector<uint64_t> started_;
+    uint64_t note_count_{0};
+
+    std::vector<size_t> heap_;
+    bool heap_valid_{false};
+
+    std::vector<map_entry> map_;
+    size_t map_shift_{0};
+};
+
+}
@@ -7,11 +7,12 @@ namespace lyrid
     
 enum class voice_state { free, active, releasing };
 
+// Read by every node on every block; note ids and other bookkeeping live
+// in voice_manager so this stays small.
 struct voice_parameters
 {
     float base_freq_;
     voice_state state_{voice_state::free};
-    uint64_t id_;
     float smoothed_power_;
 };
 
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace lyrid
+{
+
+// Streams interleaved 32-bit float samples into a WAV file through a
+// large buffer. The header sizes are patched when the writer is closed.
+class wav_writer
+{
+public:
+    static constexpr size_t buffer_bytes = 1 << 20;
+    
+    wav_writer(const std::string& path, uint16_t channels, uint32_t rate);
+    ~wav_writer();
+    
+    wav_writer(const wav_writer&) = delete;
+    wav_writer& operator=(const wav_writer&) = delete;
+    
+    // Allocates the file's blocks for a known length up front, best effort.
+    void reserve(size_t frames);
+    
+    // Throws once the data would no longer fit the 32-bit WAV sizes.
+    void write(const float* samples, size_t frames);
+    
+    // Patches the header and closes the file, throwing if either fails. The
+    // destructor does the same but keeps quiet.
+    void close();
+    
+private:
+    bool write_header();
+    
+    std::unique_ptr<char[]> buffer_;
+    std::FILE* file_;
+    uint16_t channels_;
+    uint32_t rate_;
+    uint64_t frames_written_{0};
+};
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "global_constants.hpp"
+
+namespace lyrid
+{
+
+using task_fn = void (*)(void*, size_t);
+
+// Pre-spawned real-time worker threads for fan-out inside the audio callback.
+// run() executes tasks [0, count) on the workers and the calling thread.
+// Tasks are dealt round-robin, so callers sorting tasks by decreasing cost get
+// a longest-processing-time-first split; a thread whose share is done steals
+// from the others. run() never locks or allocates, and is not reentrant: a
+// task must not call run() on the pool executing it.
+class worker_pool
+{
+public:
+    worker_pool(size_t workers = std::max(std::thread::hardware_concurrency(), 1u) - 1, int rt_priority = 70);
+    ~worker_pool();
+    
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+    
+    void run(task_fn fn, void* ctx, size_t count);
+    
+    // Threads taking part in run(), the caller included.
+    size_t size() const
+    {
+        return workers_.size() + 1;
+    }
+    
+private:
+    enum worker_state : uint32_t { idle, assigned, running, stopping };
+    
+    struct alignas(cache_line_size) queue
+    {
+        std::atomic<size_t> next_{0};
+    };
+    
+    struct alignas(cache_line_size) worker
+    {
+        std::atomic<uint32_t> state_{idle};
+        std::thread thread_;
+    };
+    
+    void worker_loop(size_t self, int rt_priority);
+    void execute(size_t self);
+    
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::unique_ptr<queue[]> queues_;
+    
+    task_fn fn_{nullptr};
+    void* ctx_{nullptr};
+    size_t count_{0};
+    std::atomic<bool> running_{false};
+    
+    static constexpr size_t spin_iterations = 20000;
+};
+
+}
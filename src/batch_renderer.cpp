@@ -0,0 +1,75 @@
+#include "batch_renderer.hpp"
+#include "offline_renderer.hpp"
+#include "score.hpp"
+#include "global_constants.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+
+namespace lyrid
+{
+    double batch_stats::hours_per_minute() const
+    {
+        return wall_seconds_ > 0.0 ? (audio_seconds_ / 3600.0) / (wall_seconds_ / 60.0) : 0.0;
+    }
+
+    batch_renderer::batch_renderer(patch p, size_t voices, render_mode mode, size_t threads):
+        patch_(p), voices_(voices), mode_(mode), threads_(std::max<size_t>(threads, 1))
+    {}
+
+    batch_stats batch_renderer::run(const std::vector<batch_job>& jobs, std::vector<batch_result>& results)
+    {
+        results.assign(jobs.size(), batch_result{});
+        std::atomic<size_t> next{0};
+
+        auto worker = [&]
+        {
+            for (size_t j = next.fetch_add(1); j < jobs.size(); j = next.fetch_add(1))
+                results[j] = render_job(jobs[j]);
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        size_t count = std::min(threads_, jobs.size());
+        for (size_t t = 1; t < count; ++t)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& t : threads)
+            t.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        batch_stats stats;
+        stats.jobs_ = jobs.size();
+        stats.wall_seconds_ = elapsed.count();
+        for (const batch_result& r : results)
+        {
+            stats.failed_ += !r.error_.empty();
+            stats.audio_seconds_ += static_cast<double>(r.frames_) / sample_rate();
+        }
+        return stats;
+    }
+
+    batch_result batch_renderer::render_job(const batch_job& job)
+    {
+        batch_result result;
+        try
+        {
+            score s = load_score(job.score_);
+            poly_instrument instrument(voices_, patch_, mode_);
+            offline_renderer renderer(instrument);
+
+            render_stats stats = renderer.render_score(s, job.output_);
+            result.frames_ = stats.frames_;
+            result.render_seconds_ = stats.seconds_;
+        }
+        catch (const std::exception& e)
+        {
+            result.error_ = e.what();
+        }
+        return result;
+    }
+}
@@ -1,38 +1,76 @@
 #include "device.hpp"
 #include "global_constants.hpp"
-#include "poly_instrument.hpp"
+#include "engine.hpp"
+#include "realtime.hpp"
+#include "profiler.hpp"
+#include "rt_check.hpp"
 
 #include <stdexcept>
+#include <algorithm>
+#include <cstdio>
 
 namespace lyrid
 {
-    device::device(poly_instrument& instr):
-        instr_(instr)
+    device::device(engine& eng, const device_config& settings):
+        engine_(eng),
+        rt_priority_(settings.rt_priority_)
     {
+        ma_context_config context_config = ma_context_config_init();
+        if (settings.rt_priority_ > 0)
+            context_config.threadPriority = ma_thread_priority_realtime;
+        
+        if (ma_context_init(nullptr, 0, &context_config, &context_) != MA_SUCCESS)
+            throw std::runtime_error("Failed to initialize audio context");
+        
         ma_device_config config = ma_device_config_init(ma_device_type_playback);
         config.playback.format = ma_format_f32;
         config.playback.channels = 2;
-        config.sampleRate = sample_rate;
+        // Zero asks for the device's native rate, so miniaudio has nothing to resample.
+        config.sampleRate = 0;
+        config.periodSizeInFrames = settings.period_frames_;
+        config.periods = settings.periods_;
+        config.performanceProfile = settings.low_latency_ ? ma_performance_profile_low_latency : ma_performance_profile_conservative;
+        // The engine writes every frame it is asked for.
+        config.noPreSilencedOutputBuffer = MA_TRUE;
         config.dataCallback = data_callback;
         config.pUserData = this;
         
-        if (ma_device_init(nullptr, &config, &dev_) != MA_SUCCESS)
+        if (ma_device_init(&context_, &config, &dev_) != MA_SUCCESS)
+        {
+            ma_context_uninit(&context_);
             throw std::runtime_error("Failed to initialize audio device");
+        }
             
         initialized_ = true;
+        set_sample_rate(dev_.sampleRate);
+        
+        // Once everything the callback will use exists, so all of it is resident.
+        // Instrument buffers are prefaulted when built either way.
+        if (settings.lock_memory_ && !lock_memory())
+            std::fprintf(stderr, "lyrid: could not lock memory, page faults may interrupt playback; raise RLIMIT_MEMLOCK (ulimit -l)\n");
     }
 
     void device::data_callback(ma_device* device_ptr, void* output_ptr, const void*, ma_uint32 frame_count)
     {
         device* dev_ptr = static_cast<device*>(device_ptr->pUserData);
         
-        float* output = static_cast<float*>(output_ptr);
-        for (ma_uint32 i = 0; i < frame_count; ++i)
+        // Backends may restart the callback thread, so this is per thread.
+        thread_local bool prepared = false;
+        if (!prepared)
         {
-            float sample = dev_ptr->instr_.sample();
-            output[i * 2 + 0] = sample;
-            output[i * 2 + 1] = sample;
+            prepare_render_thread(dev_ptr->rt_priority_);
+            prepared = true;
         }
+        
+        rt_scope scope;
+        
+        profiler* prof = dev_ptr->profiler_;
+        uint64_t start = prof != nullptr ? prof->begin() : 0;
+        
+        dev_ptr->engine_.render(static_cast<float*>(output_ptr), frame_count);
+        
+        if (prof != nullptr)
+            prof->end(start, frame_count);
     }
 
     void device::start()
@@ -45,5 +83,6 @@ namespace lyrid
     {
         if (initialized_)
             ma_device_uninit(&dev_);
+        ma_context_uninit(&context_);
     }
 }
@@ -0,0 +1,171 @@
+#include "engine.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace lyrid
+{
+    namespace
+    {
+        // Constant power pan of a mono input.
+        void pan_gains(float gain, float pan, float& left, float& right)
+        {
+            float angle = (std::clamp(pan, -1.0f, 1.0f) + 1.0f) * std::numbers::pi_v<float> / 4;
+            left = gain * std::cos(angle) * std::numbers::sqrt2_v<float>;
+            right = gain * std::sin(angle) * std::numbers::sqrt2_v<float>;
+        }
+
+        // Balance of a stereo input: panning attenuates the far side only.
+        void balance_gains(float gain, float pan, float& left, float& right)
+        {
+            pan = std::clamp(pan, -1.0f, 1.0f);
+            left = gain * std::min(1.0f, 1.0f - pan);
+            right = gain * std::min(1.0f, 1.0f + pan);
+        }
+    }
+
+    engine::engine(worker_pool* pool):
+        pool_(pool)
+    {
+        auto master = std::make_unique<bus>();
+        master->parent_ = no_bus;
+        buses_.push_back(std::move(master));
+    }
+
+    size_t engine::add_bus(size_t parent, float gain, float pan)
+    {
+        size_t idx = buses_.size();
+        auto b = std::make_unique<bus>();
+        b->parent_ = parent;
+        buses_.push_back(std::move(b));
+        buses_[parent]->buses_.push_back(idx);
+        set_bus_mix(idx, gain, pan);
+        return idx;
+    }
+
+    size_t engine::add_instrument(size_t max_voices, patch p, size_t bus_idx, render_mode mode, float gain, float pan)
+    {
+        size_t idx = sources_.size();
+        auto s = std::make_unique<source>();
+        s->instr_ = std::make_unique<poly_instrument>(max_voices, p, mode);
+        s->bus_ = bus_idx;
+        sources_.push_back(std::move(s));
+        buses_[bus_idx]->sources_.push_back(idx);
+
+        // The pool cannot be entered again from inside one of its own tasks.
+        sources_[0]->instr_->set_worker_pool(sources_.size() == 1 ? pool_ : nullptr);
+        set_instrument_mix(idx, gain, pan);
+        return idx;
+    }
+
+    void engine::set_instrument_mix(size_t idx, float gain, float pan)
+    {
+        sources_[idx]->mix_.gain_.store(gain, std::memory_order_relaxed);
+        sources_[idx]->mix_.pan_.store(pan, std::memory_order_relaxed);
+    }
+
+    void engine::set_bus_mix(size_t idx, float gain, float pan)
+    {
+        buses_[idx]->mix_.gain_.store(gain, std::memory_order_relaxed);
+        buses_[idx]->mix_.pan_.store(pan, std::memory_order_relaxed);
+    }
+
+    void engine::render(float* out, size_t frames)
+    {
+        while (frames > 0)
+        {
+            size_t block = std::min(frames, max_block_size);
+            render_block(out, block);
+            out += block * 2;
+            frames -= block;
+        }
+    }
+
+    void engine::render_block(float* out, size_t frames)
+    {
+        frames_ = frames;
+
+        for (auto& b : buses_)
+            b->pending_.store(b->sources_.size() + b->buses_.size(), std::memory_order_relaxed);
+
+        // Buses without inputs are complete before anything renders.
+        for (size_t b = buses_.size(); b-- > 0;)
+        {
+            if (buses_[b]->sources_.empty() && buses_[b]->buses_.empty())
+                mix_bus(b);
+        }
+
+        if (pool_ != nullptr && sources_.size() > 1)
+            pool_->run(render_source_task, this, sources_.size());
+        else
+        {
+            for (size_t i = 0; i < sources_.size(); ++i)
+                render_source(i);
+        }
+
+        const bus& master = *buses_[master_bus];
+        for (size_t i = 0; i < frames; ++i)
+        {
+            out[i * 2 + 0] = master.left_[i];
+            out[i * 2 + 1] = master.right_[i];
+        }
+    }
+
+    void engine::render_source_task(void* ctx, size_t i)
+    {
+        static_cast<engine*>(ctx)->render_source(i);
+    }
+
+    void engine::render_source(size_t idx)
+    {
+        source& s = *sources_[idx];
+        s.instr_->render(s.out_, frames_);
+        input_done(s.bus_);
+    }
+
+    // The last input to arrive mixes the bus and passes it on, so buffers
+    // published by a release are read after the matching acquire.
+    void engine::input_done(size_t bus_idx)
+    {
+        if (buses_[bus_idx]->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            mix_bus(bus_idx);
+    }
+
+    // Inputs are summed in a fixed order, whichever thread completes the bus.
+    void engine::mix_bus(size_t bus_idx)
+    {
+        bus& b = *buses_[bus_idx];
+        std::fill_n(b.left_, frames_, 0.0f);
+        std::fill_n(b.right_, frames_, 0.0f);
+
+        for (size_t idx : b.sources_)
+        {
+            const source& s = *sources_[idx];
+            float left, right;
+            pan_gains(s.mix_.gain_.load(std::memory_order_relaxed), s.mix_.pan_.load(std::memory_order_relaxed), left, right);
+
+            for (size_t i = 0; i < frames_; ++i)
+            {
+                b.left_[i] += s.out_[i] * left;
+                b.right_[i] += s.out_[i] * right;
+            }
+        }
+
+        for (size_t idx : b.buses_)
+        {
+            const bus& in = *buses_[idx];
+            float left, right;
+            balance_gains(in.mix_.gain_.load(std::memory_order_relaxed), in.mix_.pan_.load(std::memory_order_relaxed), left, right);
+
+            for (size_t i = 0; i < frames_; ++i)
+            {
+                b.left_[i] += in.left_[i] * left;
+                b.right_[i] += in.right_[i] * right;
+            }
+        }
+
+        if (b.parent_ != no_bus)
+            input_done(b.parent_);
+    }
+}
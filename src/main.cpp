@@ -1,50 +1,152 @@
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <chrono>
+#include <vector>
 
 #include "patch_wrapper.hpp"
+#include "patch_program.hpp"
 #include "device.hpp"
-#include "poly_instrument.hpp"
+#include "engine.hpp"
+#include "worker_pool.hpp"
+#include "profiler.hpp"
+#include "batch_renderer.hpp"
 
-#include "dsp/wave_generators.hpp"
-#include "dsp/base_freq.hpp"
-#include "dsp/envelope.hpp"
-#include "dsp/constant.hpp"
-#include "dsp/volume.hpp"
-#include "dsp/mix.hpp"
-#include "dsp/detune.hpp"
-#include "dsp/polynomial.hpp"
+#include "patches.hpp"
 
 using namespace lyrid;
-using namespace lyrid::dsp;
 
-int main()
+namespace
 {
-    using lfo = sine<constant<7.0f>>;
-    using vibrato = linear<lfo, base_freq, constant<5.0f>>;
-    patch p = wrap<
-        volume
-        <
-            mix
-            < 
-                saw<detune<vibrato, constant<-8.0f>>>, 
-                saw<detune<vibrato, constant<-5.0f>>>, 
-                saw<detune<vibrato, constant<-2.0f>>>, 
-                saw<vibrato>, 
-                saw<detune<vibrato, constant<1.0f>>>, 
-                saw<detune<vibrato, constant<3.0f>>>, 
-                saw<detune<vibrato, constant<7.0f>>>, 
-                saw<detune<vibrato, constant<9.0f>>>
-            >,
-            envelope_ar<constant<0.5f>, constant<5.0f>>
-        >
-    >();
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Failed to open " + path);
+    
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+size_t read_count(const std::string& option, const std::string& value)
+{
+    size_t used = 0;
+    unsigned long count = 0;
+    try
+    {
+        count = std::stoul(value, &used);
+    }
+    catch (const std::logic_error&)
+    {
+    }
+    
+    if (used == 0 || used != value.size() || count == 0 || value.starts_with('-'))
+        throw std::runtime_error(option + " expects a positive number, got '" + value + "'");
+    return count;
+}
+
+// lyrid --batch [--patch file.lyr] [--voices n] [--jobs n] [--out dir] score...
+// Bounces each score, text or MIDI, to dir/<name>.wav.
+int run_batch(int argc, char** argv)
+{
+    std::optional<patch_program> program;
+    patch p = wrap<patches::unison_supersaw>();
+    size_t voices = 16;
+    size_t jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    std::filesystem::path out_dir = ".";
+    std::vector<std::string> scores;
+    
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        
+        if (arg == "--patch" && has_value)
+        {
+            program.emplace(read_file(argv[++i]));
+            p = program->as_patch();
+        }
+        else if (arg == "--voices" && has_value)
+            voices = read_count(arg, argv[++i]);
+        else if (arg == "--jobs" && has_value)
+            jobs = read_count(arg, argv[++i]);
+        else if (arg == "--out" && has_value)
+            out_dir = argv[++i];
+        else if (arg.starts_with("--"))
+            throw std::runtime_error("Unknown option " + arg);
+        else
+            scores.push_back(arg);
+    }
+    
+    // Outputs are named once every option is known, wherever --out appears.
+    // Two scores with the same name would race on one file, so neither runs.
+    std::vector<batch_job> batch;
+    std::map<std::string, std::string> score_of;
+    for (const std::string& score : scores)
+    {
+        std::filesystem::path out = (out_dir / std::filesystem::path(score).stem()).lexically_normal();
+        out += ".wav";
+        
+        auto [it, added] = score_of.emplace(out.string(), score);
+        if (!added)
+            throw std::runtime_error(it->second + " and " + score + " would both be written to " + out.string());
+        batch.push_back(batch_job{score, out.string()});
+    }
     
+    batch_renderer renderer(p, voices, render_mode::lanes, jobs);
+    std::vector<batch_result> results;
+    batch_stats stats = renderer.run(batch, results);
+    
+    for (size_t j = 0; j < batch.size(); ++j)
+    {
+        if (!results[j].error_.empty())
+            std::cerr << batch[j].score_ << ": " << results[j].error_ << "\n";
+    }
+    
+    std::cout << stats.jobs_ - stats.failed_ << " of " << stats.jobs_ << " scores, "
+        << stats.audio_seconds_ / 3600.0 << " h of audio in " << stats.wall_seconds_ << " s: "
+        << stats.hours_per_minute() << " rendered hours per minute\n";
+    
+    return stats.failed_ == 0 ? 0 : 1;
+}
+
+}
+
+int main(int argc, char** argv)
+{
     try
     {
-        poly_instrument instrument(16, p);
-        device dev(instrument);
+        if (argc > 1 && std::string(argv[1]) == "--batch")
+            return run_batch(argc, argv);
+        
+        // A patch file given on the command line plays the lead.
+        std::optional<patch_program> program;
+        patch lead_patch = wrap<patches::unison_supersaw>();
+        
+        if (argc > 1)
+        {
+            program.emplace(read_file(argv[1]));
+            lead_patch = program->as_patch();
+        }
+        
+        worker_pool pool;
+        engine eng(&pool);
+        
+        size_t pads = eng.add_bus(engine::master_bus, 0.8f);
+        size_t lead = eng.add_instrument(16, lead_patch, engine::master_bus, render_mode::scalar, 1.0f, -0.3f);
+        size_t pad = eng.add_instrument(16, wrap<patches::sine_pad>(), pads, render_mode::scalar, 0.7f, 0.3f);
+        
+        // Outlives the device, whose callback reports to it.
+        profiler prof(eng);
+        device dev(eng, device_config::low_latency());
+        dev.set_profiler(&prof);
         
         std::string line;
     
@@ -59,20 +161,32 @@ int main()
         
         for (int i = 0; i < freqs.size(); ++i, ++id)
         {
-            size_t idx = instrument.on(id, freqs[i]);
-            std::cout << "Note ON " << id << " at " << idx << "\n";
-            std::this_thread::sleep_for(std::chrono::milliseconds(4000));
+            eng.instrument(lead).note_on(id, freqs[i]);
+            eng.instrument(pad).note_on(id, freqs[i] / 2);
+            std::cout << "Note ON " << id << "\n";
+            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            
+            if (i == 1 && !program)
+            {
+                eng.instrument(lead).publish(wrap<patches::bl_unison_supersaw>(), handoff::crossfade);
+                std::cout << "Lead patch swapped\n";
+            }
+            
+            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
             
-            idx = instrument.off(id);
-            std::cout << "Note OFF " << id << " at " << idx << "\n";
+            eng.instrument(lead).note_off(id);
+            eng.instrument(pad).note_off(id);
+            std::cout << "Note OFF " << id << "\n";
         }
             
+        std::cout << profiler::to_text(prof.snapshot()) << "\n";
         std::cout << "ENTER to quit\n";
         std::getline(std::cin, line);
     }
-    catch (const std::runtime_error& e)
+    catch (const std::exception& e)
     {
         std::cerr << e.what() << "\n";
+        return 1;
     }
     
     return 0;
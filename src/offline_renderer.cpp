@@ -0,0 +1,91 @@
+#include "offline_renderer.hpp"
+#include "poly_instrument.hpp"
+#include "wav_writer.hpp"
+#include "global_constants.hpp"
+#include "realtime.hpp"
+#include "score.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace lyrid
+{
+    namespace
+    {
+        constexpr size_t wav_chunk_frames = 8192;
+    }
+    
+    double render_stats::audio_seconds() const
+    {
+        return static_cast<double>(frames_) / sample_rate();
+    }
+    
+    double render_stats::real_time_factor() const
+    {
+        return seconds_ > 0.0 ? audio_seconds() / seconds_ : 0.0;
+    }
+    
+    offline_renderer::offline_renderer(poly_instrument& instr):
+        instr_(instr),
+        chunk_(wav_chunk_frames)
+    {}
+    
+    render_stats offline_renderer::render(std::span<float> out)
+    {
+        // Same arithmetic as on the audio thread, denormal tails included.
+        disable_denormals();
+        
+        auto start = std::chrono::steady_clock::now();
+        instr_.render(out.data(), out.size());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        
+        return render_stats{out.size(), elapsed.count()};
+    }
+    
+    render_stats offline_renderer::render_to_wav(const std::string& path, size_t frames)
+    {
+        wav_writer writer(path, 1, sample_rate());
+        writer.reserve(frames);
+        render_stats stats{frames, 0.0};
+        
+        for (size_t done = 0; done < frames;)
+        {
+            size_t n = std::min(frames - done, chunk_.size());
+            stats.seconds_ += render(std::span<float>(chunk_.data(), n)).seconds_;
+            writer.write(chunk_.data(), n);
+            done += n;
+        }
+        
+        writer.close();
+        return stats;
+    }
+    
+    render_stats offline_renderer::render_score(const score& s, const std::string& path)
+    {
+        wav_writer writer(path, 1, sample_rate());
+        writer.reserve(s.frames_);
+        render_stats stats{s.frames_, 0.0};
+        size_t next = 0;
+        
+        for (uint64_t done = 0; done < s.frames_;)
+        {
+            uint64_t end = std::min<uint64_t>(s.frames_, done + chunk_.size());
+            
+            while (next < s.events_.size() && s.events_[next].time_ < end && instr_.post(s.events_[next]))
+                ++next;
+            
+            // A full event queue: render up to the first event left over, so
+            // the instrument takes in what it has.
+            if (next < s.events_.size() && s.events_[next].time_ < end)
+                end = std::max(done + 1, s.events_[next].time_);
+            
+            size_t n = end - done;
+            stats.seconds_ += render(std::span<float>(chunk_.data(), n)).seconds_;
+            writer.write(chunk_.data(), n);
+            done = end;
+        }
+        
+        writer.close();
+        return stats;
+    }
+}
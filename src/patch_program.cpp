@@ -0,0 +1,1425 @@
+#include "patch_program.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "global_constants.hpp"
+#include "patch_wrapper.hpp"
+#include "simd.hpp"
+#include "dsp/control.hpp"
+#include "dsp/envelope.hpp"
+#include "dsp/external.hpp"
+#include "dsp/math.hpp"
+#include "dsp/polynomial.hpp"
+#include "dsp/wave_generators.hpp"
+#include "dsp/wavetable.hpp"
+
+namespace lyrid
+{
+    namespace
+    {
+        using envelope_node = dsp::envelope<dsp::variable, dsp::variable, dsp::variable, dsp::variable, dsp::variable, dsp::variable>;
+        using lfo_node = dsp::control<dsp::lfo<dsp::variable>>;
+
+        constexpr uint16_t no_scope = std::numeric_limits<uint16_t>::max();
+        constexpr size_t max_quiet_depth = 32;
+        constexpr size_t max_nesting = 256;
+
+        enum class node_kind : uint8_t
+        {
+            number,
+            base_freq,
+            ratio,
+            detune,
+            polynomial,
+            mix,
+            volume,
+            sine,
+            fast_sine,
+            saw,
+            square,
+            triangle,
+            bl_saw,
+            bl_square,
+            bl_triangle,
+            white_noise,
+            pink_noise,
+            lfo,
+            envelope
+        };
+
+        struct node_spec
+        {
+            std::string_view name_;
+            node_kind kind_;
+            size_t min_args_;
+            size_t max_args_;
+        };
+
+        constexpr size_t any = patch_program::max_args;
+
+        // Names as in the template patches. envelope_ar takes attack and
+        // release, the rest of an envelope at its defaults.
+        constexpr node_spec node_specs[] =
+        {
+            {"base_freq", node_kind::base_freq, 0, 0},
+            {"detune", node_kind::detune, 2, 2},
+            {"linear", node_kind::polynomial, 3, 3},
+            {"polynomial", node_kind::polynomial, 2, any},
+            {"mix", node_kind::mix, 1, any},
+            {"volume", node_kind::volume, 2, 2},
+            {"sine", node_kind::sine, 1, 1},
+            {"fast_sine", node_kind::fast_sine, 1, 1},
+            {"saw", node_kind::saw, 1, 1},
+            {"square", node_kind::square, 1, 1},
+            {"triangle", node_kind::triangle, 1, 1},
+            {"bl_saw", node_kind::bl_saw, 1, 1},
+            {"bl_square", node_kind::bl_square, 1, 1},
+            {"bl_triangle", node_kind::bl_triangle, 1, 1},
+            {"white_noise", node_kind::white_noise, 0, 0},
+            {"pink_noise", node_kind::pink_noise, 0, 0},
+            {"lfo", node_kind::lfo, 1, 1},
+            {"envelope", node_kind::envelope, 6, 6},
+            {"envelope_ar", node_kind::envelope, 2, 2}
+        };
+
+        const node_spec* find_spec(std::string_view name)
+        {
+            for (const node_spec& spec : node_specs)
+            {
+                if (spec.name_ == name)
+                    return &spec;
+            }
+            return nullptr;
+        }
+
+        // Oscillator state for a per-note or an audio rate frequency.
+        template<template<typename> typename Osc, typename F>
+        void visit_freq(bool scalar, F&& f)
+        {
+            if (scalar)
+                f.template operator()<Osc<dsp::variable>>();
+            else
+                f.template operator()<Osc<dsp::input>>();
+        }
+
+        template<typename F>
+        void visit_oscillator(node_kind kind, bool scalar, F&& f)
+        {
+            switch (kind)
+            {
+                case node_kind::sine:
+                    visit_freq<dsp::sine>(scalar, f);
+                    break;
+                case node_kind::fast_sine:
+                    visit_freq<dsp::fast_sine>(scalar, f);
+                    break;
+                case node_kind::saw:
+                    visit_freq<dsp::saw>(scalar, f);
+                    break;
+                case node_kind::square:
+                    visit_freq<dsp::square>(scalar, f);
+                    break;
+                case node_kind::triangle:
+                    visit_freq<dsp::triangle>(scalar, f);
+                    break;
+                case node_kind::bl_saw:
+                    visit_freq<dsp::bl_saw>(scalar, f);
+                    break;
+                case node_kind::bl_square:
+                    visit_freq<dsp::bl_square>(scalar, f);
+                    break;
+                case node_kind::bl_triangle:
+                    visit_freq<dsp::bl_triangle>(scalar, f);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        bool is_oscillator(node_kind kind)
+        {
+            return kind >= node_kind::sine && kind <= node_kind::bl_triangle;
+        }
+    }
+
+    // Interpreter registers and the quiet spans of the scopes being run.
+    // Instructions inside a scope render from offset_ on, as a template
+    // volume renders its input after a quiet start.
+    struct patch_program::frame
+    {
+        frame(const patch_program& program, const voice_parameters& params, std::byte* state, float (*regs)[max_block_size], size_t frames):
+            program_(program), params_(params), state_(state),
+            scalars_(reinterpret_cast<const float*>(state + program.scalars_offset_)), regs_(regs), frames_(frames)
+        {}
+
+        float* reg(uint16_t idx)
+        {
+            return regs_[idx] + offset_;
+        }
+
+        size_t count() const
+        {
+            return frames_ - offset_;
+        }
+
+        template<typename Node>
+        Node& node(uint32_t offset)
+        {
+            return *reinterpret_cast<Node*>(state_ + offset);
+        }
+
+        const patch_program& program_;
+        const voice_parameters& params_;
+        std::byte* state_;
+        const float* scalars_;
+        float (*regs_)[max_block_size];
+        size_t frames_;
+        size_t offset_{0};
+        size_t pc_{0};
+        size_t depth_{0};
+        std::array<size_t, max_scopes> outer_;
+        std::array<size_t, max_scopes> quiet_;
+    };
+
+    struct patch_kernels
+    {
+        using frame = patch_program::frame;
+        using instruction = patch_program::instruction;
+
+        // Stateful dsp node, its frequency input fed from a scalar or a register.
+        template<typename Node>
+        static void node(const instruction& in, frame& f)
+        {
+            Node& n = f.node<Node>(in.state_);
+
+            if constexpr (requires { n.freq_.src_; })
+                n.freq_.src_ = f.reg(in.a_);
+            else if constexpr (requires { n.freq_.value_; })
+                n.freq_.value_ = f.scalars_[in.a_];
+            else if constexpr (requires { n.src_.freq_.value_; })
+                n.src_.freq_.value_ = f.scalars_[in.a_];
+
+            n.process_block(f.params_, f.reg(in.dst_), f.count());
+        }
+
+        static void fill(const instruction& in, frame& f)
+        {
+            std::fill_n(f.reg(in.dst_), f.count(), f.scalars_[in.a_]);
+        }
+
+        // detune by a per-note ratio.
+        static void scale(const instruction& in, frame& f)
+        {
+            float* dst = f.reg(in.dst_);
+            const float* src = f.reg(in.a_);
+            float factor = f.scalars_[in.b_];
+
+            for (size_t i = 0; i < f.count(); ++i)
+                dst[i] = src[i] * factor;
+        }
+
+        static void detune(const instruction& in, frame& f)
+        {
+            float* dst = f.reg(in.dst_);
+            const float* val = f.reg(in.a_);
+            const float* cents = f.reg(in.b_);
+
+            for (size_t i = 0; i < f.count(); ++i)
+                dst[i] = val[i] * dsp::cents_to_ratio(cents[i]);
+        }
+
+        static void polynomial(const instruction& in, frame& f)
+        {
+            float power[max_block_size];
+            float* out = f.reg(in.dst_);
+            const float* x = f.reg(in.a_);
+            size_t frames = f.count();
+
+            std::fill_n(out, frames, 0.0f);
+            std::fill_n(power, frames, 1.0f);
+
+            for (uint32_t k = 0; k < in.count_; ++k)
+            {
+                const patch_program::operand& coeff = f.program_.operands_[in.first_ + k];
+                if (coeff.scalar_)
+                    dsp::accumulate_term(out, power, f.scalars_[coeff.index_], x, frames);
+                else
+                    dsp::accumulate_term(out, power, f.reg(coeff.index_), x, frames);
+            }
+        }
+
+        // mix sums its inputs as they are rendered, so they need not all be
+        // held in registers at once. The sum starts from zero like the template's.
+        static void mix_first(const instruction& in, frame& f)
+        {
+            float* dst = f.reg(in.dst_);
+            const float* src = f.reg(in.a_);
+
+            for (size_t i = 0; i < f.count(); ++i)
+                dst[i] = 0.0f + src[i];
+        }
+
+        static void mix_add(const instruction& in, frame& f)
+        {
+            dsp::add_block(f.reg(in.dst_), f.reg(in.a_), f.count());
+        }
+
+        static void mix_end(const instruction& in, frame& f)
+        {
+            dsp::scale_block(f.reg(in.dst_), 1.0f / in.count_, f.count());
+        }
+
+        // volume by a per-note level.
+        static void gain(const instruction& in, frame& f)
+        {
+            float* dst = f.reg(in.dst_);
+            const float* src = f.reg(in.a_);
+            float factor = dsp::pow4(f.scalars_[in.b_]);
+
+            for (size_t i = 0; i < f.count(); ++i)
+                dst[i] = src[i] * factor;
+        }
+
+        // Inside its scope the input only covers the frames after the quiet start.
+        static void volume(const instruction& in, frame& f)
+        {
+            float* dst = f.reg(in.dst_);
+            const float* val = f.reg(in.a_);
+            const float* vol = f.reg(in.b_);
+            size_t frames = f.count();
+            size_t quiet = in.scope_ != no_scope ? f.quiet_[in.scope_] : 0;
+
+            std::fill_n(dst, quiet, 0.0f);
+            for (size_t i = quiet; i < frames; ++i)
+                dst[i] = val[i] * dsp::pow4(vol[i]);
+        }
+
+        // Skips the start of the scope the volume input renders in, or all
+        // of it when the whole block is quiet. Where the quiet span ends the
+        // scope's nodes restart, as a template volume restarts its input.
+        static void begin_quiet(const instruction& in, frame& f)
+        {
+            size_t span = f.program_.quiet(f.params_, f.state_, in.first_, in.count_);
+            size_t quiet = std::min(span, f.count());
+            if (span > 0 && span <= f.count())
+                f.program_.restart(f.state_, in.state_, in.a_);
+            f.quiet_[in.scope_] = quiet;
+            f.outer_[f.depth_++] = f.offset_;
+            f.offset_ += quiet;
+
+            if (f.offset_ == f.frames_)
+                f.pc_ = in.jump_;
+        }
+
+        static void end_quiet(const instruction&, frame& f)
+        {
+            f.offset_ = f.outer_[--f.depth_];
+        }
+    };
+
+    // Parses straight into a graph of unique nodes, folding constants, then
+    // lays out voice state, assigns every audio node a scope and emits code
+    // scope by scope with block registers handed out as values die.
+    class patch_compiler
+    {
+    public:
+        patch_compiler(patch_program& program, std::string_view source):
+            program_(program), source_(source)
+        {}
+
+        void compile()
+        {
+            program_.prototype_.resize(sizeof(const patch_program*));
+
+            advance();
+            size_t root = parse_program();
+
+            order(root);
+            layout();
+            assign_scopes(root);
+            count_uses(root);
+
+            emit_scope(0);
+            program_.result_ = block(root);
+
+            auto [first, count] = quiet_range(root);
+            program_.root_quiet_first_ = first;
+            program_.root_quiet_count_ = count;
+
+            finish();
+        }
+
+    private:
+        enum class token_kind
+        {
+            name,
+            number,
+            open,
+            close,
+            comma,
+            equals,
+            end
+        };
+
+        struct token
+        {
+            token_kind kind_;
+            std::string_view text_;
+            float value_;
+            size_t line_;
+        };
+
+        struct dag_node
+        {
+            node_kind kind_;
+            float value_;
+            std::vector<size_t> args_;
+            dsp::rate rate_;
+        };
+
+        struct scope
+        {
+            size_t parent_;
+            size_t depth_;
+        };
+
+        static constexpr size_t none = size_t(-1);
+
+        [[noreturn]] void fail(size_t line, const std::string& message) const
+        {
+            throw std::runtime_error("patch line " + std::to_string(line) + ": " + message);
+        }
+
+        // Lexing
+
+        token lex()
+        {
+            while (pos_ < source_.size())
+            {
+                char c = source_[pos_];
+                if (c == '#')
+                {
+                    while (pos_ < source_.size() && source_[pos_] != '\n')
+                        ++pos_;
+                }
+                else if (c == '\n')
+                {
+                    ++line_;
+                    ++pos_;
+                }
+                else if (c == ' ' || c == '\t' || c == '\r')
+                    ++pos_;
+                else
+                    break;
+            }
+
+            if (pos_ == source_.size())
+                return token{token_kind::end, {}, 0.0f, line_};
+
+            size_t start = pos_;
+            char c = source_[pos_];
+
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_')
+            {
+                while (pos_ < source_.size() && (std::isalnum(static_cast<unsigned char>(source_[pos_])) || source_[pos_] == '_'))
+                    ++pos_;
+                return token{token_kind::name, source_.substr(start, pos_ - start), 0.0f, line_};
+            }
+
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '.')
+            {
+                float value;
+                auto [end, ec] = std::from_chars(source_.data() + pos_, source_.data() + source_.size(), value);
+                if (ec != std::errc())
+                    fail(line_, "bad number");
+                pos_ = end - source_.data();
+                return token{token_kind::number, source_.substr(start, pos_ - start), value, line_};
+            }
+
+            ++pos_;
+            switch (c)
+            {
+                case '(':
+                    return token{token_kind::open, source_.substr(start, 1), 0.0f, line_};
+                case ')':
+                    return token{token_kind::close, source_.substr(start, 1), 0.0f, line_};
+                case ',':
+                    return token{token_kind::comma, source_.substr(start, 1), 0.0f, line_};
+                case '=':
+                    return token{token_kind::equals, source_.substr(start, 1), 0.0f, line_};
+                default:
+                    fail(line_, "unexpected '" + std::string(1, c) + "'");
+            }
+        }
+
+        void advance()
+        {
+            tok_ = lex();
+        }
+
+        bool next_is(token_kind kind)
+        {
+            size_t pos = pos_;
+            size_t line = line_;
+            bool match = lex().kind_ == kind;
+            pos_ = pos;
+            line_ = line;
+            return match;
+        }
+
+        void expect(token_kind kind, const char* what)
+        {
+            if (tok_.kind_ != kind)
+                fail(tok_.line_, std::string("expected ") + what);
+            advance();
+        }
+
+        // Parsing
+
+        size_t parse_program()
+        {
+            while (tok_.kind_ == token_kind::name && next_is(token_kind::equals))
+            {
+                std::string name(tok_.text_);
+                size_t line = tok_.line_;
+                if (find_spec(name) != nullptr || definitions_.contains(name))
+                    fail(line, "'" + name + "' is already defined");
+
+                advance();
+                advance();
+                definitions_[name] = parse_expression();
+            }
+
+            if (tok_.kind_ == token_kind::end)
+                fail(tok_.line_, "patch has no output expression");
+
+            size_t root = parse_expression();
+            if (tok_.kind_ != token_kind::end)
+                fail(tok_.line_, "expected the end of the patch after its output expression");
+
+            return root;
+        }
+
+        size_t parse_expression()
+        {
+            token t = tok_;
+
+            if (t.kind_ == token_kind::number)
+            {
+                advance();
+                return number(t.value_);
+            }
+
+            if (t.kind_ != token_kind::name)
+                fail(t.line_, "expected a node, a name or a number");
+
+            advance();
+            std::string name(t.text_);
+
+            if (tok_.kind_ != token_kind::open)
+            {
+                if (auto it = definitions_.find(name); it != definitions_.end())
+                    return it->second;
+            }
+
+            const node_spec* spec = find_spec(name);
+            if (spec == nullptr)
+                fail(t.line_, "unknown name '" + name + "'");
+
+            std::vector<size_t> args;
+            if (tok_.kind_ == token_kind::open)
+            {
+                // The parser recurses once per level.
+                if (++nesting_ > max_nesting)
+                    fail(t.line_, "expressions nested more than " + std::to_string(max_nesting) + " deep");
+                
+                advance();
+                if (tok_.kind_ != token_kind::close)
+                {
+                    args.push_back(parse_expression());
+                    while (tok_.kind_ == token_kind::comma)
+                    {
+                        advance();
+                        args.push_back(parse_expression());
+                    }
+                }
+                expect(token_kind::close, "')'");
+                --nesting_;
+            }
+
+            if (args.size() < spec->min_args_ || args.size() > spec->max_args_)
+                fail(t.line_, "wrong number of arguments to " + name);
+
+            if (spec->name_ == "envelope_ar")
+                args = {number(0.0f), args[0], number(0.0f), number(0.0f), number(1.0f), args[1]};
+
+            if (spec->kind_ == node_kind::lfo && is_audio(args[0]))
+                fail(t.line_, "lfo rates must be per note");
+
+            if (spec->kind_ == node_kind::envelope)
+            {
+                for (size_t a : args)
+                {
+                    if (dag_[a].kind_ != node_kind::number)
+                        fail(t.line_, "envelope times and levels must be numbers");
+                }
+            }
+
+            return make(spec->kind_, std::move(args));
+        }
+
+        // Graph
+
+        size_t number(float value)
+        {
+            return intern(dag_node{node_kind::number, value, {}, dsp::rate::constant});
+        }
+
+        size_t make(node_kind kind, std::vector<size_t> args)
+        {
+            dsp::rate rate = dsp::rate::audio;
+            if (kind == node_kind::base_freq)
+                rate = dsp::rate::note;
+            else if (kind <= node_kind::volume)
+            {
+                rate = dsp::rate::constant;
+                for (size_t a : args)
+                    rate = std::max(rate, dag_[a].rate_);
+            }
+
+            if (rate == dsp::rate::constant)
+            {
+                std::array<float, patch_program::max_args> values;
+                for (size_t k = 0; k < args.size(); ++k)
+                    values[k] = dag_[args[k]].value_;
+                return number(patch_program::evaluate(note_op_of(kind), 0.0f, values.data(), args.size()));
+            }
+
+            return intern(dag_node{kind, 0.0f, std::move(args), rate});
+        }
+
+        size_t intern(dag_node node)
+        {
+            std::vector<uint32_t> key{static_cast<uint32_t>(node.kind_), std::bit_cast<uint32_t>(node.value_)};
+            for (size_t a : node.args_)
+                key.push_back(static_cast<uint32_t>(a));
+
+            auto [it, inserted] = index_.try_emplace(std::move(key), dag_.size());
+            if (inserted)
+                dag_.push_back(std::move(node));
+            return it->second;
+        }
+
+        static patch_program::note_op note_op_of(node_kind kind)
+        {
+            switch (kind)
+            {
+                case node_kind::base_freq:
+                    return patch_program::note_op::base_freq;
+                case node_kind::ratio:
+                    return patch_program::note_op::ratio;
+                case node_kind::detune:
+                    return patch_program::note_op::detune;
+                case node_kind::polynomial:
+                    return patch_program::note_op::polynomial;
+                case node_kind::mix:
+                    return patch_program::note_op::mix;
+                default:
+                    return patch_program::note_op::volume;
+            }
+        }
+
+        bool is_audio(size_t id) const
+        {
+            return dag_[id].rate_ == dsp::rate::audio;
+        }
+
+        // Analysis
+
+        // Audio nodes, children first. Chained definitions make the graph
+        // as deep as the patch is long, so the walk keeps its own stack.
+        void order(size_t root)
+        {
+            std::vector<uint8_t> seen(dag_.size());
+            std::vector<std::pair<size_t, size_t>> stack;
+            if (is_audio(root))
+            {
+                seen[root] = 1;
+                stack.push_back({root, 0});
+            }
+            while (!stack.empty())
+            {
+                auto& [id, next] = stack.back();
+                if (next == dag_[id].args_.size())
+                {
+                    topo_.push_back(id);
+                    stack.pop_back();
+                    continue;
+                }
+                
+                size_t a = dag_[id].args_[next++];
+                if (is_audio(a) && !seen[a])
+                {
+                    seen[a] = 1;
+                    stack.push_back({a, 0});
+                }
+            }
+        }
+
+        template<typename Node>
+        void add_state(size_t id, const Node& node)
+        {
+            static_assert(std::is_trivially_copyable_v<Node> && alignof(Node) <= cache_line_size);
+
+            std::vector<std::byte>& proto = program_.prototype_;
+            size_t offset = (proto.size() + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+            proto.resize(offset + sizeof(Node));
+            std::memcpy(proto.data() + offset, &node, sizeof(Node));
+            state_[id] = static_cast<uint32_t>(offset);
+            state_bytes_[id] = sizeof(Node);
+        }
+
+        void layout()
+        {
+            state_.assign(dag_.size(), 0);
+            state_bytes_.assign(dag_.size(), 0);
+
+            for (size_t id : topo_)
+            {
+                const dag_node& n = dag_[id];
+
+                if (is_oscillator(n.kind_))
+                {
+                    visit_oscillator(n.kind_, !is_audio(n.args_[0]),
+                        [&]<typename Osc>()
+                        {
+                            add_state(id, Osc{});
+                        });
+                }
+                else if (n.kind_ == node_kind::white_noise)
+                    add_state(id, dsp::white_noise{});
+                else if (n.kind_ == node_kind::pink_noise)
+                    add_state(id, dsp::pink_noise{});
+                else if (n.kind_ == node_kind::lfo)
+                    add_state(id, lfo_node{});
+                else if (n.kind_ == node_kind::envelope)
+                {
+                    std::array<dsp::variable, 6> p;
+                    for (size_t k = 0; k < 6; ++k)
+                        p[k].value_ = dag_[n.args_[k]].value_;
+                    add_state(id, envelope_node(p[0], p[1], p[2], p[3], p[4], p[5]));
+                }
+            }
+
+            quiet_.resize(dag_.size());
+            for (size_t id : topo_)
+                quiet_[id] = quiet_terms(id);
+        }
+
+        // Mirrors quiet() of the template nodes: envelopes report their span,
+        // volume its level's while that is quiet and its input's after, mix
+        // the shortest of its inputs'.
+        std::vector<patch_program::quiet_term> quiet_terms(size_t id) const
+        {
+            using quiet_op = patch_program::quiet_op;
+            const dag_node& n = dag_[id];
+            std::vector<patch_program::quiet_term> terms;
+
+            if (n.kind_ == node_kind::envelope)
+                terms.push_back({quiet_op::envelope, state_[id]});
+            else if (n.kind_ == node_kind::volume || n.kind_ == node_kind::mix)
+            {
+                size_t count = 0;
+                for (size_t a : n.args_)
+                {
+                    if (!is_audio(a) || quiet_[a].empty())
+                    {
+                        if (n.kind_ == node_kind::mix)
+                            return {};
+                        continue;
+                    }
+                    terms.insert(terms.end(), quiet_[a].begin(), quiet_[a].end());
+                    ++count;
+                }
+                if (count > 1)
+                    terms.push_back({n.kind_ == node_kind::mix ? quiet_op::min : quiet_op::volume, static_cast<uint32_t>(count)});
+            }
+            return terms;
+        }
+
+        bool scoped(size_t id) const
+        {
+            const dag_node& n = dag_[id];
+            return n.kind_ == node_kind::volume && is_audio(n.args_[0]) && is_audio(n.args_[1]) && !quiet_[n.args_[1]].empty();
+        }
+
+        bool within(size_t s, size_t outer) const
+        {
+            while (scopes_[s].depth_ > scopes_[outer].depth_)
+                s = scopes_[s].parent_;
+            return s == outer;
+        }
+
+        size_t common_scope(size_t a, size_t b) const
+        {
+            while (scopes_[a].depth_ > scopes_[b].depth_)
+                a = scopes_[a].parent_;
+            while (scopes_[b].depth_ > scopes_[a].depth_)
+                b = scopes_[b].parent_;
+            while (a != b)
+            {
+                a = scopes_[a].parent_;
+                b = scopes_[b].parent_;
+            }
+            return a;
+        }
+
+        // The input of a volume with a quiet hint renders in a scope of its
+        // own, so it can be paused. A node used from several scopes lives in
+        // the innermost one holding all its uses.
+        void assign_scopes(size_t root)
+        {
+            scopes_.push_back(scope{none, 0});
+            scope_of_.assign(dag_.size(), none);
+            inner_.assign(dag_.size(), none);
+            scope_of_[root] = 0;
+            anchored_.resize(topo_.size());
+            
+            std::vector<size_t> position(dag_.size());
+            for (size_t k = 0; k < topo_.size(); ++k)
+                position[topo_[k]] = k;
+
+            for (size_t k = topo_.size(); k-- > 0;)
+            {
+                size_t id = topo_[k];
+                const dag_node& n = dag_[id];
+
+                if (scoped(id))
+                {
+                    anchored_[position[n.args_[0]]].push_back(id);
+                    
+                    if (scopes_.size() == patch_program::max_scopes)
+                        fail(line_, "too many nested volumes");
+                    inner_[id] = scopes_.size();
+                    scopes_.push_back(scope{scope_of_[id], scopes_[scope_of_[id]].depth_ + 1});
+                }
+
+                for (size_t i = 0; i < n.args_.size(); ++i)
+                {
+                    size_t a = n.args_[i];
+                    if (!is_audio(a))
+                        continue;
+
+                    size_t use = (i == 0 && inner_[id] != none) ? inner_[id] : scope_of_[id];
+                    scope_of_[a] = scope_of_[a] == none ? use : common_scope(scope_of_[a], use);
+                }
+            }
+        }
+
+        void count_uses(size_t root)
+        {
+            uses_.assign(dag_.size(), 0);
+            for (size_t id : topo_)
+            {
+                for (size_t a : dag_[id].args_)
+                {
+                    if (is_audio(a))
+                        ++uses_[a];
+                }
+            }
+            ++uses_[root];
+            reg_.assign(dag_.size(), 0);
+            
+            emitted_.assign(dag_.size(), 0);
+            summed_.assign(dag_.size(), 0);
+            mixes_.resize(dag_.size());
+            for (size_t id : topo_)
+            {
+                if (dag_[id].kind_ != node_kind::mix)
+                    continue;
+                
+                for (size_t a : dag_[id].args_)
+                {
+                    if (is_audio(a) && (mixes_[a].empty() || mixes_[a].back() != id))
+                        mixes_[a].push_back(id);
+                }
+            }
+        }
+
+        // Scalars
+
+        uint16_t scalar(size_t id)
+        {
+            if (auto it = scalar_slots_.find(id); it != scalar_slots_.end())
+                return it->second;
+
+            const dag_node& n = dag_[id];
+            if (n.kind_ == node_kind::number)
+                return add_scalar(id, n.value_);
+
+            std::vector<uint16_t> args;
+            for (size_t a : dag_[id].args_)
+                args.push_back(scalar(a));
+
+            uint16_t slot = add_scalar(id, 0.0f);
+            program_.note_code_.push_back({note_op_of(dag_[id].kind_), slot,
+                static_cast<uint32_t>(program_.note_args_.size()), static_cast<uint32_t>(args.size())});
+            program_.note_args_.insert(program_.note_args_.end(), args.begin(), args.end());
+            return slot;
+        }
+
+        uint16_t add_scalar(size_t id, float value)
+        {
+            uint16_t slot = static_cast<uint16_t>(scalars_.size());
+            scalars_.push_back(value);
+            scalar_slots_[id] = slot;
+            return slot;
+        }
+
+        // Registers
+
+        uint16_t allocate()
+        {
+            for (size_t r = 0; r < patch_program::max_registers; ++r)
+            {
+                if (!busy_[r])
+                {
+                    busy_[r] = true;
+                    program_.register_count_ = std::max(program_.register_count_, r + 1);
+                    return static_cast<uint16_t>(r);
+                }
+            }
+            fail(line_, "patch needs more than " + std::to_string(patch_program::max_registers) + " block registers");
+        }
+
+        // Audio operands as registers; per-note values are broadcast into a
+        // temporary, freed after the instruction reading it.
+        uint16_t block(size_t id)
+        {
+            if (is_audio(id))
+                return reg_[id];
+
+            uint16_t r = allocate();
+            emit(patch_kernels::fill, r, scalar(id));
+            temps_.push_back(r);
+            return r;
+        }
+
+        void release(size_t input)
+        {
+            if (is_audio(input) && --uses_[input] == 0)
+                busy_[reg_[input]] = false;
+        }
+
+        void release(const std::vector<size_t>& inputs)
+        {
+            for (size_t a : inputs)
+                release(a);
+            for (uint16_t r : temps_)
+                busy_[r] = false;
+            temps_.clear();
+        }
+
+        // Elementwise instructions may write over an input read for the
+        // last time; the others get a fresh register.
+        uint16_t result(size_t id, bool in_place)
+        {
+            if (in_place)
+                release(dag_[id].args_);
+            reg_[id] = allocate();
+            if (!in_place)
+                release(dag_[id].args_);
+            return reg_[id];
+        }
+
+        patch_program::instruction& emit(patch_program::handler run, uint16_t dst, uint16_t a = 0, uint16_t b = 0)
+        {
+            program_.code_.push_back(patch_program::instruction{run, dst, a, b, no_scope, 0, 0, 0, 0});
+            return program_.code_.back();
+        }
+
+        std::pair<uint32_t, uint32_t> quiet_range(size_t id)
+        {
+            const auto& terms = quiet_[id];
+
+            size_t depth = 0;
+            for (const patch_program::quiet_term& t : terms)
+            {
+                depth = t.op_ == patch_program::quiet_op::envelope ? depth + 1 : depth - t.arg_ + 1;
+                if (depth > max_quiet_depth)
+                    fail(line_, "volume nesting too deep for quiet hints");
+            }
+
+            uint32_t first = static_cast<uint32_t>(program_.quiet_terms_.size());
+            program_.quiet_terms_.insert(program_.quiet_terms_.end(), terms.begin(), terms.end());
+            return {first, static_cast<uint32_t>(terms.size())};
+        }
+
+        // Code generation
+
+        // A volume's scope is emitted where its input falls in the order,
+        // ahead of the level it asks for the quiet span, as a template
+        // volume asks before rendering either.
+        void emit_scope(size_t s)
+        {
+            for (size_t k = 0; k < topo_.size(); ++k)
+            {
+                for (size_t id : anchored_[k])
+                {
+                    if (scope_of_[id] == s)
+                        emit_inner(id);
+                }
+
+                if (scope_of_[topo_[k]] == s)
+                {
+                    emit_node(topo_[k]);
+                    emitted(topo_[k]);
+                }
+            }
+        }
+
+        // The nodes a scope restarts are those rendered in it or in scopes
+        // nested inside it.
+        void emit_inner(size_t id)
+        {
+            auto [first, count] = quiet_range(dag_[id].args_[1]);
+            size_t restart = program_.restarts_.size();
+            for (size_t node : topo_)
+            {
+                if (state_bytes_[node] > 0 && within(scope_of_[node], inner_[id]))
+                    program_.restarts_.push_back({state_[node], state_bytes_[node]});
+            }
+            if (program_.restarts_.size() - restart > std::numeric_limits<uint16_t>::max())
+                fail(line_, "too many nodes inside one volume");
+
+            size_t begin = program_.code_.size();
+            patch_program::instruction& in = emit(patch_kernels::begin_quiet, 0);
+            in.scope_ = static_cast<uint16_t>(inner_[id]);
+            in.first_ = first;
+            in.count_ = count;
+            in.state_ = static_cast<uint32_t>(restart);
+            in.a_ = static_cast<uint16_t>(program_.restarts_.size() - restart);
+
+            emit_scope(inner_[id]);
+
+            program_.code_[begin].jump_ = static_cast<uint32_t>(program_.code_.size());
+            emit(patch_kernels::end_quiet, 0);
+        }
+
+        void emit_node(size_t id)
+        {
+            const dag_node& n = dag_[id];
+
+            if (is_oscillator(n.kind_))
+            {
+                size_t freq = n.args_[0];
+                uint16_t a = is_audio(freq) ? reg_[freq] : scalar(freq);
+                visit_oscillator(n.kind_, !is_audio(freq),
+                    [&]<typename Osc>()
+                    {
+                        uint16_t dst = result(id, true);
+                        emit(patch_kernels::node<Osc>, dst, a).state_ = state_[id];
+                    });
+                return;
+            }
+
+            switch (n.kind_)
+            {
+                case node_kind::white_noise:
+                    emit(patch_kernels::node<dsp::white_noise>, result(id, true)).state_ = state_[id];
+                    break;
+                case node_kind::pink_noise:
+                    emit(patch_kernels::node<dsp::pink_noise>, result(id, true)).state_ = state_[id];
+                    break;
+                case node_kind::lfo:
+                    emit(patch_kernels::node<lfo_node>, result(id, true), scalar(n.args_[0])).state_ = state_[id];
+                    break;
+                case node_kind::envelope:
+                    emit(patch_kernels::node<envelope_node>, result(id, true)).state_ = state_[id];
+                    break;
+                case node_kind::detune:
+                    emit_detune(id);
+                    break;
+                case node_kind::polynomial:
+                    emit_polynomial(id);
+                    break;
+                case node_kind::mix:
+                    emit_mix(id);
+                    break;
+                case node_kind::volume:
+                    emit_volume(id);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void emit_detune(size_t id)
+        {
+            size_t val = dag_[id].args_[0];
+            size_t cents = dag_[id].args_[1];
+
+            if (!is_audio(cents))
+            {
+                uint16_t ratio = scalar(make(node_kind::ratio, {cents}));
+                uint16_t a = reg_[val];
+                emit(patch_kernels::scale, result(id, true), a, ratio);
+                return;
+            }
+
+            uint16_t a = block(val);
+            uint16_t b = reg_[cents];
+            emit(patch_kernels::detune, result(id, true), a, b);
+        }
+
+        void emit_polynomial(size_t id)
+        {
+            const std::vector<size_t> args = dag_[id].args_;
+            uint16_t x = block(args[0]);
+
+            uint32_t first = static_cast<uint32_t>(program_.operands_.size());
+            for (size_t k = 1; k < args.size(); ++k)
+            {
+                if (is_audio(args[k]))
+                    program_.operands_.push_back({reg_[args[k]], false});
+                else
+                    program_.operands_.push_back({scalar(args[k]), true});
+            }
+
+            patch_program::instruction& in = emit(patch_kernels::polynomial, result(id, false), x);
+            in.first_ = first;
+            in.count_ = static_cast<uint32_t>(args.size() - 1);
+        }
+
+        // Adds the inputs of a mix that are ready, in order, into its sum.
+        void accumulate(size_t id)
+        {
+            const std::vector<size_t> args = dag_[id].args_;
+
+            for (; summed_[id] < args.size(); ++summed_[id])
+            {
+                size_t a = args[summed_[id]];
+                if (is_audio(a) && !emitted_[a])
+                    return;
+
+                uint16_t src = block(a);
+                bool first = summed_[id] == 0;
+                
+                release(a);
+                for (uint16_t r : temps_)
+                    busy_[r] = false;
+                temps_.clear();
+                
+                if (first)
+                    reg_[id] = allocate();
+                emit(first ? patch_kernels::mix_first : patch_kernels::mix_add, reg_[id], src);
+            }
+        }
+
+        void emit_mix(size_t id)
+        {
+            accumulate(id);
+            emit(patch_kernels::mix_end, reg_[id]).count_ = static_cast<uint32_t>(dag_[id].args_.size());
+        }
+
+        void emitted(size_t id)
+        {
+            emitted_[id] = 1;
+            for (size_t m : mixes_[id])
+                accumulate(m);
+        }
+
+        void emit_volume(size_t id)
+        {
+            size_t val = dag_[id].args_[0];
+            size_t vol = dag_[id].args_[1];
+
+            if (!is_audio(vol))
+            {
+                uint16_t a = reg_[val];
+                emit(patch_kernels::gain, result(id, true), a, scalar(vol));
+                return;
+            }
+
+            uint16_t a = block(val);
+            uint16_t b = reg_[vol];
+            patch_program::instruction& in = emit(patch_kernels::volume, result(id, true), a, b);
+            if (inner_[id] != none)
+                in.scope_ = static_cast<uint16_t>(inner_[id]);
+        }
+
+        void finish()
+        {
+            std::vector<std::byte>& proto = program_.prototype_;
+
+            program_.scalars_offset_ = (proto.size() + alignof(float) - 1) / alignof(float) * alignof(float);
+            proto.resize(program_.scalars_offset_ + scalars_.size() * sizeof(float));
+            std::memcpy(proto.data() + program_.scalars_offset_, scalars_.data(), scalars_.size() * sizeof(float));
+
+            const patch_program* self = &program_;
+            std::memcpy(proto.data(), &self, sizeof(self));
+
+            program_.slot_bytes_ = slot_size(proto.size());
+            program_.lanes_ = native_lanes();
+        }
+
+        patch_program& program_;
+        std::string_view source_;
+        size_t pos_{0};
+        size_t line_{1};
+        token tok_{};
+        size_t nesting_{0};
+
+        std::vector<dag_node> dag_;
+        std::map<std::vector<uint32_t>, size_t> index_;
+        std::map<std::string, size_t, std::less<>> definitions_;
+
+        std::vector<size_t> topo_;
+        std::vector<uint32_t> state_;
+        std::vector<uint32_t> state_bytes_;
+        std::vector<std::vector<patch_program::quiet_term>> quiet_;
+        std::vector<scope> scopes_;
+        std::vector<size_t> scope_of_;
+        std::vector<size_t> inner_;
+        std::vector<std::vector<size_t>> anchored_;
+        std::vector<size_t> uses_;
+
+        std::vector<uint16_t> reg_;
+        std::vector<uint8_t> emitted_;
+        std::vector<size_t> summed_;
+        std::vector<std::vector<size_t>> mixes_;
+        std::array<bool, patch_program::max_registers> busy_{};
+        std::vector<uint16_t> temps_;
+
+        std::map<size_t, uint16_t> scalar_slots_;
+        std::vector<float> scalars_;
+    };
+
+    patch_program::patch_program(std::string_view source)
+    {
+        patch_compiler(*this, source).compile();
+    }
+
+    patch patch_program::as_patch() const
+    {
+        patch p
+        {
+            sample_hook,
+            process_block_hook,
+            prepare_hook,
+            quiet_hook,
+            reset_hook,
+            slot_bytes_,
+            lane_kernel
+            {
+                lanes_,
+                process_lanes_hook,
+                reset_lane_hook,
+                prepare_lane_hook,
+                quiet_lane_hook,
+                construct_lanes_hook,
+                lanes_ * slot_bytes_,
+                bind_lanes_hook
+            }
+        };
+        p.bind_ = bind_hook;
+        p.data_ = this;
+        return p;
+    }
+
+    float patch_program::evaluate(note_op op, float base_freq, const float* args, size_t count)
+    {
+        switch (op)
+        {
+            case note_op::base_freq:
+                return base_freq;
+            case note_op::ratio:
+                return dsp::cents_to_ratio(args[0]);
+            case note_op::detune:
+                return args[0] * dsp::cents_to_ratio(args[1]);
+            case note_op::polynomial:
+            {
+                float power = 1.0f;
+                float sum = 0.0f;
+                for (size_t k = 1; k < count; ++k)
+                {
+                    sum += args[k] * power;
+                    power *= args[0];
+                }
+                return sum;
+            }
+            case note_op::mix:
+            {
+                float sum = 0.0f;
+                for (size_t k = 0; k < count; ++k)
+                    sum += args[k];
+                return sum / count;
+            }
+            case note_op::volume:
+                return args[0] * dsp::pow4(args[1]);
+        }
+        return 0.0f;
+    }
+
+    void patch_program::render(const voice_parameters& params, std::byte* state, float* out, size_t frames) const
+    {
+        float regs[max_registers][max_block_size];
+        frame f(*this, params, state, regs, frames);
+
+        while (f.pc_ < code_.size())
+        {
+            const instruction& in = code_[f.pc_++];
+            in.run_(in, f);
+        }
+
+        std::copy_n(regs[result_], frames, out);
+    }
+
+    void patch_program::prepare(const voice_parameters& params, std::byte* state) const
+    {
+        float* scalars = reinterpret_cast<float*>(state + scalars_offset_);
+        std::array<float, max_args> args;
+
+        for (const note_instruction& n : note_code_)
+        {
+            for (uint32_t k = 0; k < n.count_; ++k)
+                args[k] = scalars[note_args_[n.first_ + k]];
+            scalars[n.dst_] = evaluate(n.op_, params.base_freq_, args.data(), n.count_);
+        }
+    }
+
+    size_t patch_program::quiet(const voice_parameters& params, std::byte* state, uint32_t first, uint32_t count) const
+    {
+        if (count == 0)
+            return 0;
+
+        std::array<size_t, max_quiet_depth> stack;
+        size_t top = 0;
+
+        for (uint32_t k = first; k < first + count; ++k)
+        {
+            const quiet_term& t = quiet_terms_[k];
+            switch (t.op_)
+            {
+                case quiet_op::envelope:
+                    stack[top++] = reinterpret_cast<envelope_node*>(state + t.arg_)->quiet(params);
+                    break;
+                case quiet_op::volume:
+                    --top;
+                    if (stack[top] > 0)
+                        stack[top - 1] = stack[top];
+                    break;
+                case quiet_op::min:
+                    top -= t.arg_;
+                    stack[top] = *std::min_element(stack.begin() + top, stack.begin() + top + t.arg_);
+                    ++top;
+                    break;
+            }
+        }
+        return stack[0];
+    }
+
+    void patch_program::restart(std::byte* state, uint32_t first, uint32_t count) const
+    {
+        for (uint32_t k = first; k < first + count; ++k)
+        {
+            const state_range& r = restarts_[k];
+            std::memcpy(state + r.offset_, prototype_.data() + r.offset_, r.bytes_);
+        }
+    }
+
+    const patch_program& patch_program::of(const void* state)
+    {
+        return **static_cast<const patch_program* const*>(state);
+    }
+
+    float patch_program::sample_hook(const voice_parameters& params, void* state)
+    {
+        float out;
+        of(state).render(params, static_cast<std::byte*>(state), &out, 1);
+        return out;
+    }
+
+    void patch_program::process_block_hook(const voice_parameters& params, void* state, float* out, size_t frames)
+    {
+        of(state).render(params, static_cast<std::byte*>(state), out, frames);
+    }
+
+    void patch_program::prepare_hook(const voice_parameters& params, void* state)
+    {
+        of(state).prepare(params, static_cast<std::byte*>(state));
+    }
+
+    size_t patch_program::quiet_hook(const voice_parameters& params, void* state)
+    {
+        const patch_program& program = of(state);
+        return program.quiet(params, static_cast<std::byte*>(state), program.root_quiet_first_, program.root_quiet_count_);
+    }
+
+    void patch_program::reset_hook(void* state)
+    {
+        const patch_program& program = of(state);
+        std::memcpy(state, program.prototype_.data(), program.prototype_.size());
+    }
+
+    void patch_program::bind_hook(void* state, const void* program)
+    {
+        const patch_program& p = *static_cast<const patch_program*>(program);
+        std::memcpy(state, p.prototype_.data(), p.prototype_.size());
+    }
+
+    // A lane group is lanes_ voice states one slot apart, rendered one after
+    // the other and interleaved.
+    void patch_program::process_lanes_hook(const voice_parameters* voices, void* group, float* out, size_t frames)
+    {
+        const patch_program& program = of(group);
+        auto* base = static_cast<std::byte*>(group);
+        float voice[max_block_size];
+
+        for (size_t l = 0; l < program.lanes_; ++l)
+        {
+            program.render(voices[l], base + l * program.slot_bytes_, voice, frames);
+            for (size_t i = 0; i < frames; ++i)
+                out[i * program.lanes_ + l] = voice[i];
+        }
+    }
+
+    void patch_program::reset_lane_hook(void* group, size_t lane)
+    {
+        const patch_program& program = of(group);
+        reset_hook(static_cast<std::byte*>(group) + lane * program.slot_bytes_);
+    }
+
+    void patch_program::prepare_lane_hook(const voice_parameters& params, void* group, size_t lane)
+    {
+        const patch_program& program = of(group);
+        program.prepare(params, static_cast<std::byte*>(group) + lane * program.slot_bytes_);
+    }
+
+    size_t patch_program::quiet_lane_hook(const voice_parameters* voices, void* group, size_t lane)
+    {
+        const patch_program& program = of(group);
+        return quiet_hook(voices[lane], static_cast<std::byte*>(group) + lane * program.slot_bytes_);
+    }
+
+    void patch_program::construct_lanes_hook(void*)
+    {
+    }
+
+    void patch_program::bind_lanes_hook(void* group, const void* program)
+    {
+        const patch_program& p = *static_cast<const patch_program*>(program);
+        for (size_t l = 0; l < p.lanes_; ++l)
+            bind_hook(static_cast<std::byte*>(group) + l * p.slot_bytes_, program);
+    }
+}
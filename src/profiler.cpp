@@ -0,0 +1,169 @@
+#include "profiler.hpp"
+#include "engine.hpp"
+#include "global_constants.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace lyrid
+{
+    namespace
+    {
+        // Ticks of cycle_count() per second, timed against steady_clock.
+        double measure_cycle_rate()
+        {
+            auto start_time = std::chrono::steady_clock::now();
+            uint64_t start = cycle_count();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            uint64_t end = cycle_count();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+            return static_cast<double>(end - start) / elapsed.count();
+        }
+
+        std::string format(const char* fmt, auto... args)
+        {
+            char buffer[256];
+            std::snprintf(buffer, sizeof(buffer), fmt, args...);
+            return buffer;
+        }
+    }
+
+    profiler::profiler(engine& eng, std::chrono::milliseconds interval):
+        engine_(eng),
+        cycles_per_second_(measure_cycle_rate())
+    {
+        thread_ = std::thread(&profiler::drain_loop, this, interval);
+    }
+
+    profiler::~profiler()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    void profiler::set_dump(std::ostream* out, profile_format format)
+    {
+        std::lock_guard lock(mutex_);
+        dump_ = out;
+        format_ = format;
+    }
+
+    void profiler::end(uint64_t start, size_t frames)
+    {
+        uint64_t cycles = cycle_count() - start;
+
+        size_t audible = 0;
+        size_t capacity = 0;
+        for (size_t i = 0; i < engine_.instrument_count(); ++i)
+        {
+            audible += engine_.instrument(i).audible_voices();
+            capacity += engine_.instrument(i).max_voices();
+        }
+
+        record r{cycles, static_cast<uint32_t>(frames), static_cast<uint32_t>(audible), static_cast<uint32_t>(capacity - audible)};
+        if (!records_.push(r))
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    profile_snapshot profiler::snapshot()
+    {
+        std::lock_guard lock(mutex_);
+        drain();
+        return totals_;
+    }
+
+    void profiler::reset()
+    {
+        std::lock_guard lock(mutex_);
+        drain();
+        totals_ = profile_snapshot{};
+        load_sum_ = 0.0;
+        dropped_.store(0, std::memory_order_relaxed);
+    }
+
+    // Called with mutex_ held.
+    void profiler::drain()
+    {
+        record r;
+        while (records_.pop(r))
+        {
+            double seconds = r.cycles_ / cycles_per_second_;
+            double load = seconds * sample_rate() / std::max<uint32_t>(r.frames_, 1);
+
+            totals_.callbacks_ += 1;
+            totals_.frames_ += r.frames_;
+            totals_.deadline_misses_ += load > 1.0;
+            totals_.max_load_ = std::max(totals_.max_load_, load);
+            totals_.worst_us_ = std::max(totals_.worst_us_, seconds * 1.0e6);
+            totals_.audible_voices_ = r.audible_voices_;
+            totals_.free_voices_ = r.free_voices_;
+            totals_.peak_voices_ = std::max<size_t>(totals_.peak_voices_, r.audible_voices_);
+            totals_.load_histogram_[std::min(static_cast<size_t>(load / load_bucket_width), load_buckets - 1)] += 1;
+
+            load_sum_ += load;
+        }
+
+        totals_.mean_load_ = totals_.callbacks_ > 0 ? load_sum_ / totals_.callbacks_ : 0.0;
+        totals_.dropped_ = dropped_.load(std::memory_order_relaxed);
+    }
+
+    void profiler::drain_loop(std::chrono::milliseconds interval)
+    {
+        std::unique_lock lock(mutex_);
+        auto stopping = [this]
+        {
+            return stopping_;
+        };
+
+        while (!wake_.wait_for(lock, interval, stopping))
+        {
+            drain();
+
+            if (dump_ != nullptr)
+            {
+                *dump_ << (format_ == profile_format::json ? to_json(totals_) : to_text(totals_)) << "\n";
+                dump_->flush();
+            }
+        }
+    }
+
+    std::string profiler::to_text(const profile_snapshot& s)
+    {
+        std::string text = format(
+            "callbacks %llu  misses %llu  dropped %llu  load mean %.1f%% max %.1f%%  worst %.0f us  voices audible %zu free %zu peak %zu\n",
+            static_cast<unsigned long long>(s.callbacks_), static_cast<unsigned long long>(s.deadline_misses_),
+            static_cast<unsigned long long>(s.dropped_), s.mean_load_ * 100, s.max_load_ * 100, s.worst_us_,
+            s.audible_voices_, s.free_voices_, s.peak_voices_);
+
+        // Only buckets that saw a callback, labelled by their lower edge.
+        text += "load";
+        for (size_t b = 0; b < load_buckets; ++b)
+        {
+            if (s.load_histogram_[b] > 0)
+                text += format(" %zu%%:%llu", b * 5, static_cast<unsigned long long>(s.load_histogram_[b]));
+        }
+        return text;
+    }
+
+    std::string profiler::to_json(const profile_snapshot& s)
+    {
+        std::string json = format(
+            "{\"callbacks\":%llu,\"frames\":%llu,\"deadline_misses\":%llu,\"dropped\":%llu,"
+            "\"mean_load\":%.4f,\"max_load\":%.4f,\"worst_us\":%.1f,"
+            "\"audible_voices\":%zu,\"free_voices\":%zu,\"peak_voices\":%zu,",
+            static_cast<unsigned long long>(s.callbacks_), static_cast<unsigned long long>(s.frames_),
+            static_cast<unsigned long long>(s.deadline_misses_), static_cast<unsigned long long>(s.dropped_),
+            s.mean_load_, s.max_load_, s.worst_us_, s.audible_voices_, s.free_voices_, s.peak_voices_);
+
+        json += format("\"load_bucket_width\":%.2f,\"load_histogram\":[", load_bucket_width);
+        for (size_t b = 0; b < load_buckets; ++b)
+            json += format(b == 0 ? "%llu" : ",%llu", static_cast<unsigned long long>(s.load_histogram_[b]));
+        json += "]}";
+        return json;
+    }
+}
@@ -0,0 +1,121 @@
+#include "realtime.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+namespace lyrid
+{
+    namespace
+    {
+        // rtkit's floor for threads it cannot make real-time.
+        constexpr int fallback_nice = -11;
+        
+        std::atomic<bool> priority_reported{false};
+        
+        void report_priority(int priority, thread_priority got)
+        {
+            if (got == thread_priority::realtime || priority_reported.exchange(true))
+                return;
+            
+            const char* fallback = got == thread_priority::limited ? "SCHED_FIFO at the RLIMIT_RTPRIO ceiling"
+                : got == thread_priority::niced ? "a raised nice value" : "normal priority";
+            std::fprintf(stderr, "lyrid: real-time priority %d refused, rendering at %s; "
+                "raise RLIMIT_RTPRIO (e.g. an audio group in limits.conf) or grant CAP_SYS_NICE\n", priority, fallback);
+        }
+    }
+    
+    thread_priority set_realtime_priority(int priority)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        sched_param param{};
+        param.sched_priority = priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+            return thread_priority::realtime;
+        
+#if defined(__linux__)
+        rlimit limit;
+        if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0)
+        {
+            param.sched_priority = static_cast<int>(std::min<rlim_t>(limit.rlim_cur, priority));
+            if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+                return thread_priority::limited;
+        }
+        
+        // RLIMIT_NICE allows nice values down to 20 minus the limit.
+        if (getrlimit(RLIMIT_NICE, &limit) == 0 && limit.rlim_cur > 20)
+        {
+            int nice = std::max(fallback_nice, 20 - static_cast<int>(std::min<rlim_t>(limit.rlim_cur, 40)));
+            auto tid = static_cast<id_t>(syscall(SYS_gettid));
+            if (setpriority(PRIO_PROCESS, tid, nice) == 0)
+                return thread_priority::niced;
+        }
+#endif
+        return thread_priority::normal;
+#else
+        (void)priority;
+        return thread_priority::normal;
+#endif
+    }
+    
+    bool lock_memory()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+        return false;
+#endif
+    }
+    
+    void disable_denormals()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        // Flush to zero and denormals are zero.
+        _mm_setcsr(_mm_getcsr() | 0x8040);
+#elif defined(__aarch64__)
+        uint64_t fpcr;
+        asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+        asm volatile("msr fpcr, %0" :: "r"(fpcr | (uint64_t(1) << 24)));
+#endif
+    }
+    
+    [[gnu::noinline]] void prefault_stack()
+    {
+        unsigned char stack[prefault_stack_bytes];
+        volatile unsigned char* touch = stack;
+        for (size_t i = 0; i < prefault_stack_bytes; i += 4096)
+            touch[i] = 0;
+    }
+    
+    void prefault(void* memory, size_t bytes)
+    {
+        volatile unsigned char* touch = static_cast<unsigned char*>(memory);
+        for (size_t i = 0; i < bytes; i += 4096)
+            touch[i] = touch[i];
+    }
+    
+    void prepare_render_thread(int priority)
+    {
+        if (priority > 0)
+            report_priority(priority, set_realtime_priority(priority));
+        disable_denormals();
+        prefault_stack();
+    }
+}
@@ -0,0 +1,261 @@
+#include "rt_check.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined(__GLIBC__)
+#error "LYRID_RT_CHECK interposes glibc's allocator and needs a glibc target"
+#endif
+
+// The allocator behind malloc and friends, which the definitions below
+// replace for the whole process.
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* ptr);
+}
+
+namespace lyrid
+{
+    namespace
+    {
+        constexpr size_t max_reports = 16;
+        constexpr int max_frames = 32;
+
+        thread_local int rt_depth = 0;
+        thread_local bool reporting = false;
+        std::atomic<size_t> violations{0};
+
+        // Everything else is interposed through the next definition in
+        // link order, looked up on first use: libraries may lock before
+        // this file's constructor has run.
+        template<typename Fn>
+        Fn resolved(Fn& slot, const char* name)
+        {
+            if (slot == nullptr)
+                slot = reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+            return slot;
+        }
+
+        struct real_functions
+        {
+            decltype(&pthread_mutex_lock) mutex_lock_;
+            decltype(&pthread_cond_wait) cond_wait_;
+            decltype(&pthread_cond_timedwait) cond_timedwait_;
+            decltype(&pthread_rwlock_rdlock) rwlock_rdlock_;
+            decltype(&pthread_rwlock_wrlock) rwlock_wrlock_;
+            decltype(&nanosleep) nanosleep_;
+            decltype(&clock_nanosleep) clock_nanosleep_;
+            decltype(&usleep) usleep_;
+            decltype(&poll) poll_;
+            decltype(&read) read_;
+            decltype(&write) write_;
+            int (*open_)(const char*, int, ...);
+        };
+
+        real_functions real{};
+
+        // Before main, so the audio thread never looks anything up.
+        [[gnu::constructor(101)]] void resolve()
+        {
+            resolved(real.mutex_lock_, "pthread_mutex_lock");
+            resolved(real.cond_wait_, "pthread_cond_wait");
+            resolved(real.cond_timedwait_, "pthread_cond_timedwait");
+            resolved(real.rwlock_rdlock_, "pthread_rwlock_rdlock");
+            resolved(real.rwlock_wrlock_, "pthread_rwlock_wrlock");
+            resolved(real.nanosleep_, "nanosleep");
+            resolved(real.clock_nanosleep_, "clock_nanosleep");
+            resolved(real.usleep_, "usleep");
+            resolved(real.poll_, "poll");
+            resolved(real.read_, "read");
+            resolved(real.write_, "write");
+            resolved(real.open_, "open");
+
+            // The first backtrace loads the unwinder, which allocates.
+            void* frame;
+            backtrace(&frame, 1);
+        }
+
+        // Called by every interposed function; reporting itself allocates and
+        // writes, so it is not checked.
+        void rt_violation(const char* what)
+        {
+            if (rt_depth == 0 || reporting)
+                return;
+
+            reporting = true;
+            int saved_errno = errno;
+
+            if (violations.fetch_add(1, std::memory_order_relaxed) < max_reports)
+            {
+                char line[128];
+                int length = std::snprintf(line, sizeof(line), "rt check: %s on a real-time thread\n", what);
+                resolved(real.write_, "write")(STDERR_FILENO, line, length);
+
+                void* frames[max_frames];
+                int depth = backtrace(frames, max_frames);
+                backtrace_symbols_fd(frames + 1, depth - 1, STDERR_FILENO);
+            }
+
+            errno = saved_errno;
+            reporting = false;
+        }
+    }
+
+    void rt_enter()
+    {
+        ++rt_depth;
+    }
+
+    void rt_leave()
+    {
+        --rt_depth;
+    }
+
+    size_t rt_violations()
+    {
+        return violations.load(std::memory_order_relaxed);
+    }
+}
+
+using lyrid::real;
+using lyrid::rt_violation;
+using lyrid::resolved;
+
+extern "C"
+{
+    void* malloc(size_t size)
+    {
+        rt_violation("malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        rt_violation("calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        rt_violation("realloc");
+        return __libc_realloc(ptr, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        rt_violation("aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** out, size_t alignment, size_t size)
+    {
+        rt_violation("posix_memalign");
+        void* ptr = __libc_memalign(alignment, size);
+        if (ptr == nullptr)
+            return ENOMEM;
+        *out = ptr;
+        return 0;
+    }
+
+    void free(void* ptr)
+    {
+        if (ptr != nullptr)
+            rt_violation("free");
+        __libc_free(ptr);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex)
+    {
+        rt_violation("pthread_mutex_lock");
+        return resolved(real.mutex_lock_, "pthread_mutex_lock")(mutex);
+    }
+
+    int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+    {
+        rt_violation("pthread_cond_wait");
+        return resolved(real.cond_wait_, "pthread_cond_wait")(cond, mutex);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const timespec* until)
+    {
+        rt_violation("pthread_cond_timedwait");
+        return resolved(real.cond_timedwait_, "pthread_cond_timedwait")(cond, mutex, until);
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t* lock)
+    {
+        rt_violation("pthread_rwlock_rdlock");
+        return resolved(real.rwlock_rdlock_, "pthread_rwlock_rdlock")(lock);
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t* lock)
+    {
+        rt_violation("pthread_rwlock_wrlock");
+        return resolved(real.rwlock_wrlock_, "pthread_rwlock_wrlock")(lock);
+    }
+
+    int nanosleep(const timespec* duration, timespec* remaining)
+    {
+        rt_violation("nanosleep");
+        return resolved(real.nanosleep_, "nanosleep")(duration, remaining);
+    }
+
+    int clock_nanosleep(clockid_t clock, int flags, const timespec* duration, timespec* remaining)
+    {
+        rt_violation("clock_nanosleep");
+        return resolved(real.clock_nanosleep_, "clock_nanosleep")(clock, flags, duration, remaining);
+    }
+
+    int usleep(useconds_t usec)
+    {
+        rt_violation("usleep");
+        return resolved(real.usleep_, "usleep")(usec);
+    }
+
+    int poll(pollfd* fds, nfds_t count, int timeout)
+    {
+        rt_violation("poll");
+        return resolved(real.poll_, "poll")(fds, count, timeout);
+    }
+
+    ssize_t read(int fd, void* buffer, size_t bytes)
+    {
+        rt_violation("read");
+        return resolved(real.read_, "read")(fd, buffer, bytes);
+    }
+
+    ssize_t write(int fd, const void* buffer, size_t bytes)
+    {
+        rt_violation("write");
+        return resolved(real.write_, "write")(fd, buffer, bytes);
+    }
+
+    int open(const char* path, int flags, ...)
+    {
+        rt_violation("open");
+
+        mode_t mode = 0;
+        if (flags & (O_CREAT | O_TMPFILE))
+        {
+            va_list args;
+            va_start(args, flags);
+            mode = va_arg(args, mode_t);
+            va_end(args);
+        }
+        return resolved(real.open_, "open")(path, flags, mode);
+    }
+}
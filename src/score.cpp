@@ -0,0 +1,312 @@
+#include "score.hpp"
+#include "global_constants.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace lyrid
+{
+    namespace
+    {
+        uint64_t to_frames(double seconds)
+        {
+            return static_cast<uint64_t>(std::llround(seconds * sample_rate()));
+        }
+
+        float midi_note_freq(int note)
+        {
+            return 440.0f * std::exp2((note - 69) / 12.0f);
+        }
+
+        // Sorts by time, keeping file order for simultaneous events, and
+        // sizes the render to end or the last event plus a tail.
+        score finish(std::vector<note_event> events, double end_seconds, double last_seconds)
+        {
+            std::stable_sort(events.begin(), events.end(),
+                [](const note_event& a, const note_event& b)
+                {
+                    return a.time_ < b.time_;
+                });
+
+            score s;
+            s.events_ = std::move(events);
+            s.frames_ = to_frames(end_seconds >= 0.0 ? end_seconds : last_seconds + score_tail_seconds);
+            return s;
+        }
+
+        // Big endian fields and variable length quantities of a MIDI file,
+        // every read bounds checked.
+        class midi_reader
+        {
+        public:
+            midi_reader(std::span<const uint8_t> data):
+                data_(data)
+            {}
+
+            bool done() const
+            {
+                return pos_ >= data_.size();
+            }
+
+            size_t pos() const
+            {
+                return pos_;
+            }
+
+            uint8_t byte()
+            {
+                need(1);
+                return data_[pos_++];
+            }
+
+            uint32_t fixed(size_t bytes)
+            {
+                uint32_t value = 0;
+                for (size_t i = 0; i < bytes; ++i)
+                    value = (value << 8) | byte();
+                return value;
+            }
+
+            uint32_t variable()
+            {
+                uint32_t value = 0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    uint8_t b = byte();
+                    value = (value << 7) | (b & 0x7f);
+                    if ((b & 0x80) == 0)
+                        return value;
+                }
+                throw std::runtime_error("MIDI file: variable length quantity too long");
+            }
+
+            void skip(size_t bytes)
+            {
+                need(bytes);
+                pos_ += bytes;
+            }
+
+            bool tag(const char* expected)
+            {
+                need(4);
+                bool match = std::equal(expected, expected + 4, data_.begin() + pos_);
+                pos_ += 4;
+                return match;
+            }
+
+        private:
+            void need(size_t bytes) const
+            {
+                if (data_.size() - pos_ < bytes)
+                    throw std::runtime_error("MIDI file: unexpected end of data");
+            }
+
+            std::span<const uint8_t> data_;
+            size_t pos_{0};
+        };
+
+        // A note or tempo change at its tick, before the tempo map applies.
+        struct midi_event
+        {
+            uint64_t tick_;
+            uint32_t tempo_;
+            note_event ev_;
+        };
+
+        void read_track(midi_reader& in, size_t end, std::vector<midi_event>& out)
+        {
+            uint64_t tick = 0;
+            uint8_t status = 0;
+
+            while (in.pos() < end)
+            {
+                tick += in.variable();
+
+                uint8_t b = in.byte();
+                if (b == 0xff)
+                {
+                    uint8_t type = in.byte();
+                    uint32_t length = in.variable();
+                    if (type == 0x51 && length == 3)
+                        out.push_back(midi_event{tick, in.fixed(3), {}});
+                    else
+                        in.skip(length);
+                    if (type == 0x2f)
+                        break;
+                    continue;
+                }
+
+                if (b == 0xf0 || b == 0xf7)
+                {
+                    in.skip(in.variable());
+                    continue;
+                }
+
+                // Running status: data bytes reuse the last status.
+                uint8_t data = 0;
+                if (b & 0x80)
+                    status = b;
+                else if (status != 0)
+                    data = b;
+                else
+                    throw std::runtime_error("MIDI file: data byte without a status");
+
+                uint8_t kind = status & 0xf0;
+                uint8_t first = (b & 0x80) ? in.byte() : data;
+                uint8_t second = (kind == 0xc0 || kind == 0xd0) ? 0 : in.byte();
+
+                uint64_t id = (static_cast<uint64_t>(status & 0x0f) << 7 | first) + 1;
+                if (kind == 0x90 && second > 0)
+                    out.push_back(midi_event{tick, 0, note_event{event_type::note_on, 0, id, midi_note_freq(first)}});
+                else if (kind == 0x80 || kind == 0x90)
+                    out.push_back(midi_event{tick, 0, note_event{event_type::note_off, 0, id, 0.0f}});
+            }
+        }
+    }
+
+    score parse_score(const std::string& text)
+    {
+        std::vector<note_event> events;
+        double end = -1.0;
+        double last = 0.0;
+
+        std::istringstream lines(text);
+        std::string line;
+        for (size_t number = 1; std::getline(lines, line); ++number)
+        {
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+
+            std::istringstream fields(line);
+            double seconds;
+            std::string action;
+            if (!(fields >> seconds >> action) || seconds < 0.0)
+                throw std::runtime_error("score line " + std::to_string(number) + ": expected a time in seconds and an event");
+
+            uint64_t id = 0;
+            float freq = 0.0f;
+            bool valid;
+            note_event ev{event_type::note_on, to_frames(seconds), 0, 0.0f};
+
+            if (action == "on" || action == "freq")
+            {
+                valid = static_cast<bool>(fields >> id >> freq) && freq > 0.0f;
+                ev.type_ = action == "on" ? event_type::note_on : event_type::set_freq;
+            }
+            else if (action == "off")
+            {
+                valid = static_cast<bool>(fields >> id);
+                ev.type_ = event_type::note_off;
+            }
+            else if (action == "end")
+            {
+                end = seconds;
+                continue;
+            }
+            else
+                throw std::runtime_error("score line " + std::to_string(number) + ": unknown event '" + action + "'");
+
+            std::string rest;
+            if (!valid || fields >> rest)
+                throw std::runtime_error("score line " + std::to_string(number) + ": " + action + " takes a note id" + (action == "off" ? "" : " and a frequency"));
+
+            ev.id_ = id;
+            ev.value_ = freq;
+            events.push_back(ev);
+            last = std::max(last, seconds);
+        }
+
+        return finish(std::move(events), end, last);
+    }
+
+    score parse_midi(std::span<const uint8_t> data)
+    {
+        midi_reader in(data);
+        if (!in.tag("MThd") || in.fixed(4) != 6)
+            throw std::runtime_error("MIDI file: missing header");
+
+        uint32_t format = in.fixed(2);
+        uint32_t tracks = in.fixed(2);
+        uint32_t division = in.fixed(2);
+        if (format > 1)
+            throw std::runtime_error("MIDI file: only formats 0 and 1 are supported");
+
+        // Ticks per quarter note, or SMPTE frames per second and ticks per frame.
+        double smpte_tick = 0.0;
+        if (division & 0x8000)
+        {
+            int fps = -static_cast<int8_t>(division >> 8);
+            if (fps <= 0 || (division & 0xff) == 0)
+                throw std::runtime_error("MIDI file: invalid SMPTE division");
+            smpte_tick = 1.0 / (fps * (division & 0xff));
+        }
+        else if (division == 0)
+            throw std::runtime_error("MIDI file: zero ticks per quarter note");
+
+        std::vector<midi_event> raw;
+        for (uint32_t t = 0; t < tracks && !in.done(); ++t)
+        {
+            bool track = in.tag("MTrk");
+            uint32_t length = in.fixed(4);
+            if (!track)
+            {
+                in.skip(length);
+                continue;
+            }
+
+            size_t end = in.pos() + length;
+            read_track(in, end, raw);
+            if (in.pos() < end)
+                in.skip(end - in.pos());
+        }
+
+        std::stable_sort(raw.begin(), raw.end(),
+            [](const midi_event& a, const midi_event& b)
+            {
+                return a.tick_ < b.tick_;
+            });
+
+        // Walk the merged tracks through the tempo map, 120 bpm until told otherwise.
+        std::vector<note_event> events;
+        double seconds = 0.0;
+        double tick_seconds = smpte_tick > 0.0 ? smpte_tick : 0.5 / division;
+        uint64_t tick = 0;
+
+        for (const midi_event& e : raw)
+        {
+            seconds += (e.tick_ - tick) * tick_seconds;
+            tick = e.tick_;
+
+            if (e.tempo_ != 0)
+            {
+                if (smpte_tick == 0.0)
+                    tick_seconds = e.tempo_ * 1.0e-6 / division;
+                continue;
+            }
+
+            note_event ev = e.ev_;
+            ev.time_ = to_frames(seconds);
+            events.push_back(ev);
+        }
+
+        return finish(std::move(events), -1.0, seconds);
+    }
+
+    score load_score(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("Failed to open " + path);
+
+        std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+        if (data.size() >= 4 && std::equal(data.begin(), data.begin() + 4, "MThd"))
+            return parse_midi(data);
+        return parse_score(std::string(data.begin(), data.end()));
+    }
+}
@@ -0,0 +1,116 @@
+#include "wav_writer.hpp"
+
+#include <stdexcept>
+#include <array>
+#include <algorithm>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#endif
+
+namespace lyrid
+{
+    namespace
+    {
+        constexpr size_t header_bytes = 44;
+        
+        // The RIFF size field counts the data plus the 36 header bytes after it.
+        constexpr uint64_t max_data_bytes = UINT32_MAX - 36;
+        
+        void put_u16(unsigned char* dst, uint16_t v)
+        {
+            dst[0] = v & 0xff;
+            dst[1] = (v >> 8) & 0xff;
+        }
+        
+        void put_u32(unsigned char* dst, uint32_t v)
+        {
+            for (int i = 0; i < 4; ++i)
+                dst[i] = (v >> (8 * i)) & 0xff;
+        }
+    }
+    
+    wav_writer::wav_writer(const std::string& path, uint16_t channels, uint32_t rate):
+        buffer_(new char[buffer_bytes]), file_(std::fopen(path.c_str(), "wb")), channels_(channels), rate_(rate)
+    {
+        if (file_ == nullptr)
+            throw std::runtime_error("Failed to open " + path);
+            
+        std::setvbuf(file_, buffer_.get(), _IOFBF, buffer_bytes);
+        if (!write_header())
+        {
+            std::fclose(file_);
+            throw std::runtime_error("Failed to write WAV header to " + path);
+        }
+    }
+    
+    void wav_writer::reserve(size_t frames)
+    {
+#if defined(__unix__)
+        off_t bytes = header_bytes + static_cast<off_t>(frames * channels_ * sizeof(float));
+        posix_fallocate(fileno(file_), 0, bytes);
+#else
+        (void)frames;
+#endif
+    }
+    
+    wav_writer::~wav_writer()
+    {
+        // Only an explicit close reports a file that could not be finished.
+        try
+        {
+            close();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+    
+    void wav_writer::write(const float* samples, size_t frames)
+    {
+        if ((frames_written_ + frames) * channels_ * sizeof(float) > max_data_bytes)
+            throw std::runtime_error("WAV data would exceed 4 GiB");
+            
+        size_t count = frames * channels_;
+        if (std::fwrite(samples, sizeof(float), count, file_) != count)
+            throw std::runtime_error("Failed to write WAV data");
+            
+        frames_written_ += frames;
+    }
+    
+    void wav_writer::close()
+    {
+        if (file_ == nullptr)
+            return;
+            
+        bool patched = std::fseek(file_, 0, SEEK_SET) == 0 && write_header();
+        bool closed = std::fclose(file_) == 0;
+        file_ = nullptr;
+        
+        if (!patched || !closed)
+            throw std::runtime_error("Failed to finish WAV file");
+    }
+    
+    bool wav_writer::write_header()
+    {
+        constexpr uint16_t ieee_float = 3;
+        uint32_t data_bytes = static_cast<uint32_t>(frames_written_ * channels_ * sizeof(float));
+        uint16_t block_align = channels_ * sizeof(float);
+        
+        std::array<unsigned char, header_bytes> h{};
+        std::copy_n("RIFF", 4, h.data());
+        put_u32(h.data() + 4, 36 + data_bytes);
+        std::copy_n("WAVEfmt ", 8, h.data() + 8);
+        put_u32(h.data() + 16, 16);
+        put_u16(h.data() + 20, ieee_float);
+        put_u16(h.data() + 22, channels_);
+        put_u32(h.data() + 24, rate_);
+        put_u32(h.data() + 28, rate_ * block_align);
+        put_u16(h.data() + 32, block_align);
+        put_u16(h.data() + 34, 8 * sizeof(float));
+        std::copy_n("data", 4, h.data() + 36);
+        put_u32(h.data() + 40, data_bytes);
+        
+        return std::fwrite(h.data(), 1, h.size(), file_) == h.size();
+    }
+}
@@ -0,0 +1,120 @@
+#include "worker_pool.hpp"
+#include "realtime.hpp"
+#include "rt_check.hpp"
+
+#include <cassert>
+
+namespace lyrid
+{
+    worker_pool::worker_pool(size_t workers, int rt_priority):
+        queues_(new queue[workers + 1])
+    {
+        workers_.reserve(workers);
+        for (size_t i = 0; i < workers; ++i)
+            workers_.push_back(std::make_unique<worker>());
+            
+        for (size_t i = 0; i < workers; ++i)
+            workers_[i]->thread_ = std::thread(&worker_pool::worker_loop, this, i + 1, rt_priority);
+    }
+    
+    worker_pool::~worker_pool()
+    {
+        for (auto& w : workers_)
+        {
+            w->state_.store(stopping, std::memory_order_release);
+            w->state_.notify_one();
+        }
+        
+        for (auto& w : workers_)
+            w->thread_.join();
+    }
+    
+    void worker_pool::run(task_fn fn, void* ctx, size_t count)
+    {
+        [[maybe_unused]] bool nested = running_.exchange(true, std::memory_order_relaxed);
+        assert(!nested && "worker_pool::run called from inside a run");
+        
+        fn_ = fn;
+        ctx_ = ctx;
+        count_ = count;
+        
+        for (size_t q = 0; q < size(); ++q)
+            queues_[q].next_.store(0, std::memory_order_relaxed);
+        
+        size_t helpers = std::min(workers_.size(), count > 0 ? count - 1 : 0);
+        for (size_t i = 0; i < helpers; ++i)
+        {
+            workers_[i]->state_.store(assigned, std::memory_order_release);
+            workers_[i]->state_.notify_one();
+        }
+        
+        execute(0);
+        
+        // Take back assignments no worker picked up yet, wait for the ones in flight.
+        for (size_t i = 0; i < helpers; ++i)
+        {
+            uint32_t expected = assigned;
+            if (workers_[i]->state_.compare_exchange_strong(expected, idle, std::memory_order_acq_rel))
+                continue;
+                
+            while (workers_[i]->state_.load(std::memory_order_acquire) != idle)
+                cpu_relax();
+        }
+        
+        running_.store(false, std::memory_order_relaxed);
+    }
+    
+    void worker_pool::execute(size_t self)
+    {
+        size_t threads = size();
+        
+        for (size_t k = 0; k < threads; ++k)
+        {
+            size_t q = (self + k) % threads;
+            
+            while (true)
+            {
+                size_t n = queues_[q].next_.fetch_add(1, std::memory_order_relaxed);
+                size_t task = q + n * threads;
+                if (task >= count_)
+                    break;
+                fn_(ctx_, task);
+            }
+        }
+    }
+    
+    void worker_pool::worker_loop(size_t self, int rt_priority)
+    {
+        prepare_render_thread(rt_priority);
+        worker& w = *workers_[self - 1];
+        
+        while (true)
+        {
+            uint32_t state = w.state_.load(std::memory_order_acquire);
+            for (size_t spin = 0; state == idle && spin < spin_iterations; ++spin)
+            {
+                cpu_relax();
+                state = w.state_.load(std::memory_order_acquire);
+            }
+            
+            if (state == idle)
+            {
+                w.state_.wait(idle, std::memory_order_acquire);
+                continue;
+            }
+            
+            if (state == stopping)
+                return;
+            
+            uint32_t expected = assigned;
+            if (!w.state_.compare_exchange_strong(expected, running, std::memory_order_acq_rel))
+                continue;
+            
+            {
+                rt_scope scope;
+                execute(self);
+            }
+            w.state_.store(idle, std::memory_order_release);
+        }
+    }
+}